@@ -0,0 +1,79 @@
+// Latency of non-blocking routines next to blocking calls on one thread:
+// a routine sleeps SLEEP_NS SAMPLES times and records how late it gets to 
+// run again, while CALLERS routines keep making a blocking call of CALL_NS
+// (nanosleep, standing for getaddrinfo, fsync and the like), either 
+// directly or through co_blocking with several helper limits. Also shows 
+// the blocking calls completed per second and the deepest queue seen.
+#include "../coroutine.h"
+#include "bench.h"
+
+#define CALLERS (8)
+#define CALL_NS (5000000)
+#define SAMPLES (200)
+#define SLEEP_NS (1000000)
+
+static int direct, stop, max_queued;
+static long calls;
+static long long late[SAMPLES];
+
+static long slow_call(void *arg) {
+    struct timespec ts = {0, CALL_NS};
+    nanosleep(&ts, NULL);
+    return 0;
+}
+
+static int caller(void) {
+    while (!stop) {
+        // a direct call leaves the thread to the others afterwards
+        if (direct) slow_call(NULL), co_yield();
+        else co_blocking(slow_call, NULL);
+        calls++;
+    }
+    return 0;
+}
+
+static int ticker(void) {
+    for (int i = 0; i < SAMPLES; ++i) {
+        long long wake = now_ns() + SLEEP_NS;
+        co_sleep(SLEEP_NS);
+        late[i] = now_ns() - wake;
+        co_blocking_stats_t stats;
+        co_blocking_stats(&stats);
+        if (stats.queued > max_queued) max_queued = stats.queued;
+    }
+    return 0;
+}
+
+static int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return (x > y) - (x < y);
+}
+
+static void run(const char *name, int threads) {
+    direct = threads == 0, stop = 0, calls = 0, max_queued = 0;
+    if (threads > 0) co_set_blocking_threads(threads);
+    long long start = now_ns();
+    for (int i = 0; i < CALLERS; ++i) co_release(co_start(caller));
+    int cid = co_start(ticker);
+    co_wait(cid);
+    co_release(cid);
+    stop = 1;
+    co_waitall();
+    double secs = (now_ns() - start) / 1e9;
+    qsort(late, SAMPLES, sizeof(late[0]), cmp_ll);
+    printf("%-16s %10.1f %10.1f %10.1f %10.0f %10d\n", name, 
+           late[SAMPLES / 2] / 1e3, late[SAMPLES * 99 / 100] / 1e3, 
+           late[SAMPLES - 1] / 1e3, calls / secs, max_queued);
+}
+
+int main() {
+    printf("wake-up lateness after a %d us sleep, next to %d routines making "
+           "%d ms blocking calls\n", SLEEP_NS / 1000, CALLERS, CALL_NS / 1000000);
+    printf("%-16s %10s %10s %10s %10s %10s\n", "", "p50 us", "p99 us", 
+           "max us", "calls/s", "max queue");
+    run("direct", 0);
+    run("1 helper", 1);
+    run("4 helpers", 4);
+    run("8 helpers", 8);
+    return 0;
+}
@@ -0,0 +1,60 @@
+// Pipeline throughput over channels: a producer, STAGES forwarding 
+// routines and a consumer connected by channels of the same capacity, in 
+// messages per second through the whole pipeline. Run on a single thread 
+// (1:N), and in a worker pool where stages hop between threads.
+#include "../coroutine.h"
+#include "bench.h"
+
+#define STAGES (8)
+#define MESSAGES (200000)
+
+static co_chan_t *chans[STAGES + 1];
+static int stage_id;
+
+static int producer(void) {
+    for (long i = 0; i < MESSAGES; ++i) co_send(chans[0], &i);
+    co_chan_close(chans[0]);
+    return 0;
+}
+
+static int stage(void) {
+    int id = stage_id++;
+    long value;
+    while (co_recv(chans[id], &value) == 0) co_send(chans[id + 1], &value);
+    co_chan_close(chans[id + 1]);
+    return 0;
+}
+
+static int consumer(void) {
+    long value, sum = 0;
+    while (co_recv(chans[STAGES], &value) == 0) sum += value;
+    return sum == (long) MESSAGES * (MESSAGES - 1) / 2;
+}
+
+static int pipeline(void) {
+    stage_id = 0;
+    int done = co_start(consumer);
+    for (int i = 0; i < STAGES; ++i) co_release(co_start(stage));
+    co_release(co_start(producer));
+    int ok = co_getret(done);
+    co_release(done);
+    return ok;
+}
+
+static void run(const char *mode, int cap, int workers) {
+    for (int i = 0; i <= STAGES; ++i) chans[i] = co_chan_create(cap, sizeof(long));
+    long long start = now_ns();
+    int ok = workers > 0? co_pool_run(workers, pipeline): pipeline();
+    long long elapsed = now_ns() - start;
+    for (int i = 0; i <= STAGES; ++i) co_chan_destroy(chans[i]);
+    printf("%-8s %6d %16.0f %s\n", mode, cap, (double) MESSAGES * 1e9 / elapsed,
+           ok? "": "(wrong sum)");
+}
+
+int main() {
+    printf("%-8s %6s %16s\n", "mode", "cap", "messages/s");
+    int caps[] = {0, 1, 16, 256};
+    for (int i = 0; i < 4; ++i) run("1:N", caps[i], 0);
+    for (int i = 0; i < 4; ++i) run("pool(2)", caps[i], 2);
+    return 0;
+}
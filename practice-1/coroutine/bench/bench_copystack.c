@@ -0,0 +1,97 @@
+// Copy-stack mode against private stacks:
+// 1. resident memory per idle routine: IDLE routines each park at a live
+//    stack depth of about DEPTH bytes, RSS is compared before and after;
+// 2. ns per co_yield round trip between two routines, as a function of
+//    the live stack depth at which they yield (each switch to a routine
+//    on the shared stack copies both routines' live frames).
+#include "../coroutine.h"
+#include "bench.h"
+#include <string.h>
+#include <unistd.h>
+
+#define IDLE (10000)
+#define DEPTH (1024)
+#define ROUNDS (200000)
+#define SHARED_STACK (1024 * 1024)
+
+static co_sem_t sem;
+static int depth;
+
+static long rss_bytes(void) {
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f == NULL) return 0;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(f);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+// live frames of about depth bytes below the routine's entry
+static __attribute__((noinline)) void at_depth(int bytes, void (*body)(void)) {
+    volatile char frame[bytes];
+    memset((char *) frame, 1, bytes);
+    body();
+    frame[0]++;
+}
+
+static void park(void) {
+    co_sem_wait(&sem);
+}
+
+static int idle_routine(void) {
+    at_depth(depth, park);
+    return 0;
+}
+
+static void yield_loop(void) {
+    for (int i = 0; i < ROUNDS; ++i) co_yield();
+}
+
+static int yield_routine(void) {
+    at_depth(depth, yield_loop);
+    return 0;
+}
+
+static double idle_memory(int shared) {
+    co_set_shared_stack(shared? SHARED_STACK: 0);
+    co_sem_init(&sem, 0);
+    depth = DEPTH;
+    long before = rss_bytes();
+    for (int i = 0; i < IDLE; ++i) co_release(co_start(idle_routine));
+    long after = rss_bytes();
+    for (int i = 0; i < IDLE; ++i) co_sem_post(&sem);
+    co_waitall();
+    return (double) (after - before) / IDLE;
+}
+
+static double round_trip(int shared, int bytes) {
+    co_set_shared_stack(shared? SHARED_STACK: 0);
+    depth = bytes;
+    long long start = now_ns();
+    int a = co_start(yield_routine), b = co_start(yield_routine);
+    co_wait(a), co_wait(b);
+    long long elapsed = now_ns() - start;
+    co_release(a), co_release(b);
+    return (double) elapsed / ROUNDS;
+}
+
+int main() {
+    if (co_set_shared_stack(0) < 0) {
+        printf("copy-stack mode is not supported by this build\n");
+        return 0;
+    }
+    printf("%d idle routines, %d bytes deep\n", IDLE, DEPTH);
+    printf("%-16s %16s\n", "", "bytes/routine");
+    printf("%-16s %16.0f\n", "private stacks", idle_memory(0));
+    printf("%-16s %16.0f\n", "copy-stack", idle_memory(1));
+
+    printf("\nco_yield round trip between two routines\n");
+    printf("%-12s %16s %16s\n", "live depth", "private ns", "copy-stack ns");
+    int depths[] = {0, 256, 1024, 4096, 16384, 65536 - 8192};
+    for (int i = 0; i < (int) (sizeof(depths) / sizeof(depths[0])); ++i) {
+        double private_ns = round_trip(0, depths[i]);
+        double shared_ns = round_trip(1, depths[i]);
+        printf("%-12d %16.1f %16.1f\n", depths[i], private_ns, shared_ns);
+    }
+    return 0;
+}
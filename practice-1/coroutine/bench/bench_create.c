@@ -0,0 +1,80 @@
+// Coroutine creation throughput:
+// 1. with 1 to 64 threads creating at once, every thread starts and 
+//    releases routines in a loop, so registry insertions, lookups and 
+//    slot reuse all run concurrently;
+// 2. fan-out of FANOUT tasks from one routine with co_start, co_spawn and 
+//    co_spawn_n: time until the creator goes on, and until all are done.
+#include "../coroutine.h"
+#include "bench.h"
+#include <pthread.h>
+
+#define PER_THREAD (100000)
+#define FANOUT (100000)
+
+static pthread_barrier_t barrier;
+
+static int dummy(void) {
+    return 0;
+}
+
+static int task(void *arg) {
+    return 0;
+}
+
+static int fanout_start(void) {
+    for (int i = 0; i < FANOUT; ++i) co_release(co_start(dummy));
+    return 0;
+}
+
+static int fanout_spawn(void) {
+    for (int i = 0; i < FANOUT; ++i) co_release(co_spawn(task, NULL));
+    return 0;
+}
+
+static int fanout_spawn_n(void) {
+    co_spawn_n(task, NULL, FANOUT, NULL);
+    return 0;
+}
+
+static void fanout(const char *name, int (*creator)(void)) {
+    long long start = now_ns();
+    // the creator runs first and finishes before anything spawned runs
+    co_release(co_start(creator));
+    long long created = now_ns();
+    co_waitall();
+    long long done = now_ns();
+    printf("%-12s %14.2f %14.2f\n", name, 
+           (created - start) / 1e6, (done - start) / 1e6);
+}
+
+static void *worker(void *arg) {
+    pthread_barrier_wait(&barrier);
+    for (int i = 0; i < PER_THREAD; ++i) co_release(co_start(dummy));
+    return NULL;
+}
+
+int main() {
+    pthread_t threads[64];
+    printf("%8s %16s\n", "threads", "creations/s");
+    for (int n = 1; n <= 64; n <<= 1) {
+        pthread_barrier_init(&barrier, NULL, n + 1);
+        for (int i = 0; i < n; ++i) 
+            pthread_create(threads + i, NULL, worker, NULL);
+        pthread_barrier_wait(&barrier);
+        long long start = now_ns();
+        for (int i = 0; i < n; ++i) pthread_join(threads[i], NULL);
+        long long elapsed = now_ns() - start;
+        pthread_barrier_destroy(&barrier);
+        printf("%8d %16.0f\n", n, (double) n * PER_THREAD * 1e9 / elapsed);
+    }
+
+    // a first run makes the control blocks, all three reuse them then
+    co_spawn_n(task, NULL, FANOUT, NULL);
+    co_waitall();
+    printf("\n%d tasks from one routine\n", FANOUT);
+    printf("%-12s %14s %14s\n", "", "created ms", "all done ms");
+    fanout("co_start", fanout_start);
+    fanout("co_spawn", fanout_spawn);
+    fanout("co_spawn_n", fanout_spawn_n);
+    return 0;
+}
@@ -0,0 +1,114 @@
+// Loopback TCP echo with 10k concurrent connections, server and clients
+// each on a single thread. Clients live in a forked process, so that each
+// side only needs one fd per connection; every client connects, then does
+// ROUNDS request/response round trips of MSG bytes before closing.
+#include "../coroutine.h"
+#include "bench.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define CONNS (10000)
+#define ROUNDS (16)
+#define MSG (64)
+
+static int listen_fd, conns, failed;
+static struct sockaddr_in addr;
+
+static int handler_fd;
+
+static int handler(void) {
+    int fd = handler_fd;
+    char buf[MSG];
+    ssize_t n;
+    while ((n = co_read(fd, buf, sizeof(buf))) > 0)
+        if (co_write(fd, buf, n) != n) break;
+    co_close(fd);
+    return 0;
+}
+
+static int acceptor(void) {
+    for (int i = 0; i < conns; ++i) {
+        int fd = co_accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            perror("accept");
+            return -1;
+        }
+        handler_fd = fd;
+        co_release(co_start(handler));
+    }
+    return 0;
+}
+
+static int client(void) {
+    char buf[MSG] = {0};
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || co_connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        failed++;
+        if (fd >= 0) co_close(fd);
+        return -1;
+    }
+    for (int i = 0; i < ROUNDS; ++i) {
+        co_write(fd, buf, MSG);
+        for (ssize_t got = 0, n; got < MSG; got += n)
+            if ((n = co_read(fd, buf + got, MSG - got)) <= 0) {
+                failed++;
+                co_close(fd);
+                return -1;
+            }
+    }
+    co_close(fd);
+    return 0;
+}
+
+// one fd per connection on each side, plus a few spare ones
+static int raise_fd_limit(void) {
+    struct rlimit lim;
+    getrlimit(RLIMIT_NOFILE, &lim);
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+    int max = (int) lim.rlim_cur - 32;
+    return max < CONNS? max: CONNS;
+}
+
+int main() {
+    conns = raise_fd_limit();
+    if (conns < CONNS)
+        printf("(RLIMIT_NOFILE only allows %d connections)\n", conns);
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if (bind(listen_fd, (struct sockaddr *) &addr, len) < 0 ||
+        listen(listen_fd, SOMAXCONN) < 0 ||
+        getsockname(listen_fd, (struct sockaddr *) &addr, &len) < 0) {
+        perror("listen");
+        return 1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(listen_fd);
+        long long start = now_ns();
+        for (int i = 0; i < conns; ++i) co_release(co_start(client));
+        co_waitall();
+        long long elapsed = now_ns() - start;
+        printf("%d connections, %d round trips each, %d failed\n",
+               conns, ROUNDS, failed);
+        printf("%.1f ms, %.0f round trips/s, %.2f us per round trip\n",
+               elapsed / 1e6, (double) conns * ROUNDS * 1e9 / elapsed,
+               elapsed / 1e3 / ((double) conns * ROUNDS));
+        return 0;
+    }
+    co_release(co_start(acceptor));
+    co_waitall();
+    waitpid(pid, NULL, 0);
+    co_close(listen_fd);
+    return 0;
+}
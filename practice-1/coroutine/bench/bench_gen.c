@@ -0,0 +1,71 @@
+// Per-element cost of streaming N values from a producer to a consumer:
+// a generator (co_gen_next/co_yield_value), a callback-based iterator
+// (the producer calls a function per element), and two routines taking
+// turns through co_yield and a shared variable, i.e. through the run queue.
+#include "../coroutine.h"
+#include "bench.h"
+
+#define N (10000000)
+
+static long sum;
+
+static int producer(void *arg) {
+    for (long i = 0; i < N; ++i) co_yield_value(i);
+    return 0;
+}
+
+static __attribute__((noinline)) void consume(long value, void *arg) {
+    sum += value;
+}
+
+static __attribute__((noinline)) void iterate(void (*callback)(long, void *), void *arg) {
+    for (long i = 0; i < N; ++i) callback(i, arg);
+}
+
+static long slot;
+static int has_value, finished;
+
+static int yield_producer(void) {
+    for (long i = 0; i < N; ++i) {
+        while (has_value) co_yield();
+        slot = i, has_value = 1;
+    }
+    finished = 1;
+    return 0;
+}
+
+static int yield_consumer(void) {
+    while (!finished || has_value) {
+        if (has_value) sum += slot, has_value = 0;
+        else co_yield();
+    }
+    return 0;
+}
+
+static void report(const char *name, long long elapsed) {
+    printf("%-12s %10.2f ns/element%s\n", name, (double) elapsed / N,
+           sum == (long) N * (N - 1) / 2? "": " (wrong sum)");
+}
+
+int main() {
+    long value;
+    sum = 0;
+    long long start = now_ns();
+    co_gen_t *gen = co_gen_start(producer, NULL);
+    while (co_gen_next(gen, &value)) sum += value;
+    co_gen_destroy(gen);
+    report("generator", now_ns() - start);
+
+    sum = 0;
+    start = now_ns();
+    iterate(consume, NULL);
+    report("callback", now_ns() - start);
+
+    sum = 0;
+    start = now_ns();
+    int consumer = co_start(yield_consumer);
+    co_start(yield_producer);
+    co_wait(consumer);
+    report("co_yield", now_ns() - start);
+    return 0;
+}
@@ -0,0 +1,53 @@
+// Cross-thread co_getret throughput: 1 to 8 threads keep reading the 
+// return value of the same finished routine, started by the main thread,
+// and ns per call is measured in each thread's own cpu time, along with 
+// the calls per second of all of them together.
+#include "../coroutine.h"
+#include "bench.h"
+#include <pthread.h>
+
+#define ROUNDS (2000000)
+
+static int cid;
+static pthread_barrier_t barrier;
+static double call_ns[8];
+
+static int answer(void) {
+    return 42;
+}
+
+static void *reader(void *arg) {
+    long idx = (long) arg;
+    co_getid();
+    pthread_barrier_wait(&barrier);
+    long long start = thread_ns();
+    long sum = 0;
+    for (int i = 0; i < ROUNDS; ++i) sum += co_getret(cid);
+    call_ns[idx] = (double) (thread_ns() - start) / ROUNDS;
+    if (sum != 42L * ROUNDS) printf("(wrong return value)\n");
+    return NULL;
+}
+
+int main() {
+    cid = co_start(answer);
+    co_wait(cid);
+    pthread_t threads[8];
+    printf("%8s %14s %14s\n", "threads", "ns/call", "Mcalls/s");
+    for (int n = 1; n <= 8; n <<= 1) {
+        pthread_barrier_init(&barrier, NULL, n + 1);
+        for (long i = 0; i < n; ++i)
+            pthread_create(threads + i, NULL, reader, (void *) i);
+        pthread_barrier_wait(&barrier);
+        long long start = now_ns();
+        for (int i = 0; i < n; ++i) pthread_join(threads[i], NULL);
+        long long elapsed = now_ns() - start;
+        pthread_barrier_destroy(&barrier);
+
+        double ns = 0;
+        for (int i = 0; i < n; ++i) ns += call_ns[i];
+        printf("%8d %14.2f %14.2f\n", n, ns / n, 
+               (double) n * ROUNDS / elapsed * 1e3);
+    }
+    co_release(cid);
+    return 0;
+}
@@ -0,0 +1,62 @@
+// Fan-out and teardown of TASKS sub-tasks from one routine, in ns per task:
+// started with co_start and each joined by co_wait, spawned in a batch and
+// each joined by co_wait, spawned in a task group (one by one, or in a 
+// batch) joined at once, and spawned in a group that is cancelled before 
+// any of them runs.
+#include "../coroutine.h"
+#include "bench.h"
+
+#define TASKS (100000)
+
+static cid_t cids[TASKS];
+static long sum;
+
+static int task(void) {
+    sum++;
+    return 0;
+}
+
+static int task_arg(void *arg) {
+    sum++;
+    return 0;
+}
+
+static double each_started(void) {
+    long long start = now_ns();
+    for (int i = 0; i < TASKS; ++i) cids[i] = co_start(task);
+    for (int i = 0; i < TASKS; ++i) co_wait(cids[i]), co_release(cids[i]);
+    return (double) (now_ns() - start) / TASKS;
+}
+
+static double each_spawned(void) {
+    long long start = now_ns();
+    co_spawn_n(task_arg, NULL, TASKS, cids);
+    for (int i = 0; i < TASKS; ++i) co_wait(cids[i]), co_release(cids[i]);
+    return (double) (now_ns() - start) / TASKS;
+}
+
+static double group(int batch, int cancel) {
+    long long start = now_ns();
+    co_group_t *group = co_group_create();
+    if (batch) co_group_spawn_n(group, task_arg, NULL, TASKS);
+    else for (int i = 0; i < TASKS; ++i) co_group_spawn(group, task_arg, NULL);
+    if (cancel) co_group_cancel(group);
+    co_group_join(group);
+    co_group_destroy(group);
+    return (double) (now_ns() - start) / TASKS;
+}
+
+int main() {
+    // warm up the control blocks, later rounds reuse them
+    each_spawned();
+    sum = 0;
+    printf("%d tasks from one routine\n", TASKS);
+    printf("%-30s %12s\n", "", "ns/task");
+    printf("%-30s %12.1f\n", "co_start + co_wait", each_started());
+    printf("%-30s %12.1f\n", "co_spawn_n + co_wait", each_spawned());
+    printf("%-30s %12.1f\n", "group spawn + join", group(0, 0));
+    printf("%-30s %12.1f\n", "group spawn_n + join", group(1, 0));
+    printf("%-30s %12.1f\n", "group spawn_n + cancel + join", group(1, 1));
+    if (sum != 4L * TASKS) printf("(%ld tasks ran, expected %d)\n", sum, 4 * TASKS);
+    return 0;
+}
@@ -0,0 +1,88 @@
+// Idle threads and cross-thread wake-ups:
+// 1. CPU time used while nothing can run for IDLE_NS, waiting for a value
+//    another thread sends then: by a plain thread, by one that also has 
+//    a routine parked on an fd, and by a pool of WORKERS workers;
+// 2. round-trip time of a ping-pong between two threads over unbuffered
+//    channels, both idle between messages.
+#include "../coroutine.h"
+#include "bench.h"
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define IDLE_NS (200000000)
+#define WORKERS (4)
+#define ROUNDS (20000)
+
+static co_chan_t *chan, *ping, *pong;
+static int fds[2];
+
+static void *sender(void *arg) {
+    struct timespec ts = {0, IDLE_NS};
+    nanosleep(&ts, NULL);
+    long value = 1;
+    co_send(chan, &value);
+    return NULL;
+}
+
+static int reader(void) {
+    char c;
+    return co_read(fds[0], &c, 1);
+}
+
+// ms of CPU time of the process while it waits for the sender
+static double wait_cpu(void) {
+    pthread_t thread;
+    struct timespec start, end;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+    pthread_create(&thread, NULL, sender, NULL);
+    long value;
+    co_recv(chan, &value);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+    pthread_join(thread, NULL);
+    return ((end.tv_sec - start.tv_sec) * 1e9 + end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+static double pool_cpu;
+
+static int pool_root(void) {
+    pool_cpu = wait_cpu();
+    return 0;
+}
+
+static void *ponger(void *arg) {
+    long value;
+    for (int i = 0; i < ROUNDS; ++i) co_recv(ping, &value), co_send(pong, &value);
+    return NULL;
+}
+
+int main() {
+    printf("CPU time while waiting %d ms for another thread\n", IDLE_NS / 1000000);
+    printf("%-30s %12s\n", "", "cpu ms");
+    chan = co_chan_create(0, sizeof(long));
+    printf("%-30s %12.2f\n", "plain thread", wait_cpu());
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    int cid = co_start(reader);
+    co_yield();
+    printf("%-30s %12.2f\n", "thread polling an fd", wait_cpu());
+    co_write(fds[1], "x", 1);
+    co_wait(cid), co_release(cid);
+    co_close(fds[0]), co_close(fds[1]);
+    co_pool_run(WORKERS, pool_root);
+    printf("%-30s %12.2f\n", "pool of 4 workers", pool_cpu);
+    co_chan_destroy(chan);
+
+    ping = co_chan_create(0, sizeof(long));
+    pong = co_chan_create(0, sizeof(long));
+    pthread_t thread;
+    pthread_create(&thread, NULL, ponger, NULL);
+    long long start = now_ns();
+    long value = 0;
+    for (int i = 0; i < ROUNDS; ++i) co_send(ping, &value), co_recv(pong, &value);
+    long long elapsed = now_ns() - start;
+    pthread_join(thread, NULL);
+    printf("\nping-pong between two threads, %d rounds\n", ROUNDS);
+    printf("%-30s %12.2f\n", "us per round trip", elapsed / 1e3 / ROUNDS);
+    co_chan_destroy(ping), co_chan_destroy(pong);
+    return 0;
+}
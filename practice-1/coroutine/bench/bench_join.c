@@ -0,0 +1,55 @@
+// Context switches per completed join in a deep fork/join tree: every node
+// starts two children and joins them, either by polling co_status with
+// co_yield in between (how co_wait used to work) or by parking in co_wait.
+#include "../coroutine.h"
+#include "bench.h"
+
+#define DEPTH (12)
+#define LEAF_YIELDS (16)
+
+static int polling, child_depth, joins;
+
+static void join(int cid) {
+    if (polling) while (co_status(cid) != FINISHED) co_yield();
+    else co_wait(cid);
+    joins++;
+}
+
+static int node(void) {
+    // co_start runs the child right away, so it reads its depth 
+    // before anyone else starts a routine
+    int depth = child_depth;
+    if (depth == 0) {
+        for (int i = 0; i < LEAF_YIELDS; ++i) co_yield();
+        return 0;
+    }
+    child_depth = depth - 1;
+    int left = co_start(node);
+    child_depth = depth - 1;
+    int right = co_start(node);
+    join(left);
+    join(right);
+    return 0;
+}
+
+static void run(const char *name) {
+    joins = 0;
+    child_depth = DEPTH;
+    long long switches = co_switch_count(), start = now_ns();
+    join(co_start(node));
+    long long elapsed = now_ns() - start;
+    switches = co_switch_count() - switches;
+    printf("%-8s %10d %16.2f %14.2f\n", name, joins, 
+        (double) switches / joins, (double) elapsed / joins);
+}
+
+int main() {
+    printf("%-8s %10s %16s %14s\n", "join", "joins", "switches/join", "ns/join");
+    // warm the stack cache up
+    run("warmup");
+    polling = 1;
+    run("polling");
+    polling = 0;
+    run("parking");
+    return 0;
+}
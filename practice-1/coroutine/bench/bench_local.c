@@ -0,0 +1,71 @@
+// Cost of looking up per-routine context, in ns per lookup from inside a 
+// routine: co_getspecific on a key kept in the control block and on a 
+// spilled one, pthread_getspecific for reference, and a side table keyed by
+// co_getid() under a mutex, as handlers do without coroutine-local storage.
+#include "../coroutine.h"
+#include "bench.h"
+#include <pthread.h>
+
+#define LOOKUPS (20000000)
+#define TABLE (1024)
+
+static co_key_t inline_key, spilled_key;
+static pthread_key_t thread_key;
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct { int cid; void *value; } table[TABLE];
+static double results[4];
+
+static void *table_get(int cid) {
+    pthread_mutex_lock(&table_lock);
+    void *value = NULL;
+    for (int i = cid % TABLE; table[i].value != NULL; i = (i + 1) % TABLE)
+        if (table[i].cid == cid) {
+            value = table[i].value;
+            break;
+        }
+    pthread_mutex_unlock(&table_lock);
+    return value;
+}
+
+static int lookups(void) {
+    int cid = co_getid();
+    co_setspecific(inline_key, &results);
+    co_setspecific(spilled_key, &results);
+    pthread_setspecific(thread_key, &results);
+    table[cid % TABLE].cid = cid, table[cid % TABLE].value = &results;
+
+    long sum = 0;
+    long long start = now_ns();
+    for (int i = 0; i < LOOKUPS; ++i) 
+        sum += (long) co_getspecific(inline_key);
+    results[0] = (double) (now_ns() - start) / LOOKUPS;
+    start = now_ns();
+    for (int i = 0; i < LOOKUPS; ++i) 
+        sum += (long) co_getspecific(spilled_key);
+    results[1] = (double) (now_ns() - start) / LOOKUPS;
+    start = now_ns();
+    for (int i = 0; i < LOOKUPS; ++i) 
+        sum += (long) pthread_getspecific(thread_key);
+    results[2] = (double) (now_ns() - start) / LOOKUPS;
+    start = now_ns();
+    for (int i = 0; i < LOOKUPS; ++i) sum += (long) table_get(co_getid());
+    results[3] = (double) (now_ns() - start) / LOOKUPS;
+    if (sum != 4L * LOOKUPS * (long) &results) printf("(wrong values)\n");
+    return 0;
+}
+
+int main() {
+    // keys beyond the ones kept in place spill
+    co_key_create(&inline_key, NULL);
+    for (int i = 0; i < 8; ++i) co_key_create(&spilled_key, NULL);
+    pthread_key_create(&thread_key, NULL);
+    int cid = co_start(lookups);
+    co_wait(cid);
+    co_release(cid);
+    printf("%-30s %12s\n", "", "ns/lookup");
+    printf("%-30s %12.2f\n", "co_getspecific, in place", results[0]);
+    printf("%-30s %12.2f\n", "co_getspecific, spilled", results[1]);
+    printf("%-30s %12.2f\n", "pthread_getspecific", results[2]);
+    printf("%-30s %12.2f\n", "co_getid + locked side table", results[3]);
+    return 0;
+}
@@ -0,0 +1,37 @@
+// Throughput of an embarrassingly parallel spawn tree in M:N mode, from one
+// worker up to one per core (or up to argv[1] workers). Every node of the
+// tree does a fixed amount of work, starts two children while the node
+// budget lasts, and waits for them.
+#include "../coroutine.h"
+#include "bench.h"
+#include <stdatomic.h>
+#include <unistd.h>
+
+#define NODES (20000)
+#define WORK (50000)
+
+static _Atomic int budget;
+
+static int node(void) {
+    int children[2], n = 0;
+    while (n < 2 && atomic_fetch_sub(&budget, 1) > 0)
+        if ((children[n] = co_start(node)) >= 0) ++n;
+    volatile unsigned int x = 0;
+    for (int i = 0; i < WORK; ++i) x = x * 31 + i;
+    for (int i = 0; i < n; ++i) co_getret(children[i]);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int cores = argc > 1? atoi(argv[1]): sysconf(_SC_NPROCESSORS_ONLN);
+    printf("%8s %16s\n", "workers", "nodes/s");
+    for (int n = 1; ; n = n * 2 < cores? n * 2: cores) {
+        atomic_store(&budget, NODES - 1);
+        long long start = now_ns();
+        co_pool_run(n, node);
+        long long elapsed = now_ns() - start;
+        printf("%8d %16.0f\n", n, NODES * 1e9 / elapsed);
+        if (n >= cores) break;
+    }
+    return 0;
+}
@@ -0,0 +1,94 @@
+// Preemption on one thread, for several time slices (0 is off):
+// 1. overhead: ms for two CPU-bound routines that never yield to do
+//    WORK iterations each, and the number of switches it took;
+// 2. latency: wake-up lateness of a routine sleeping 1 ms SAMPLES times
+//    next to a hog that only yields every BURST_NS of computing.
+#include "../coroutine.h"
+#include "bench.h"
+
+#define WORK (200000000L)
+#define SAMPLES (200)
+#define SLEEP_NS (1000000)
+#define BURST_NS (20000000)
+
+static volatile long sink;
+static volatile int done;
+static long long late[SAMPLES];
+
+static int cpu_routine(void) {
+    for (volatile long i = 0; i < WORK; ++i);
+    return 0;
+}
+
+// the clock is only read now and then, most ticks land in its own code
+static int hog_routine(void) {
+    long x = 1;
+    while (!done) {
+        long long until = now_ns() + BURST_NS;
+        while (now_ns() < until)
+            for (int i = 0; i < 4096; ++i) x = x * 6364136223846793005L + i;
+        co_yield();
+    }
+    sink = x;
+    return 0;
+}
+
+static int sleeper_routine(void) {
+    for (int i = 0; i < SAMPLES; ++i) {
+        long long wake = now_ns() + SLEEP_NS;
+        co_sleep(SLEEP_NS);
+        late[i] = now_ns() - wake;
+    }
+    done = 1;
+    return 0;
+}
+
+static int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return (x > y) - (x < y);
+}
+
+static void overhead(long long slice) {
+    co_set_preempt(slice);
+    long long switches = co_switch_count();
+    long long start = now_ns();
+    int a = co_start(cpu_routine), b = co_start(cpu_routine);
+    co_wait(a), co_wait(b);
+    long long elapsed = now_ns() - start;
+    co_release(a), co_release(b);
+    co_set_preempt(0);
+    printf("%-12.1f %12.1f %12lld\n", slice / 1e6, elapsed / 1e6,
+           co_switch_count() - switches);
+}
+
+static void latency(long long slice) {
+    co_set_preempt(slice);
+    done = 0;
+    int hog = co_start(hog_routine), sleeper = co_start(sleeper_routine);
+    co_wait(hog), co_wait(sleeper);
+    co_release(hog), co_release(sleeper);
+    co_set_preempt(0);
+    qsort(late, SAMPLES, sizeof(late[0]), cmp_ll);
+    printf("%-12.1f %12.1f %12.1f %12.1f\n", slice / 1e6,
+           late[SAMPLES / 2] / 1e3, late[SAMPLES * 99 / 100] / 1e3,
+           late[SAMPLES - 1] / 1e3);
+}
+
+int main() {
+    if (co_set_preempt(0) < 0) {
+        printf("preemption is not supported by this build\n");
+        return 0;
+    }
+    long long slices[] = {0, 10000000, 4000000, 1000000};
+    int n = sizeof(slices) / sizeof(slices[0]);
+
+    printf("two CPU-bound routines, %ld iterations each\n", WORK);
+    printf("%-12s %12s %12s\n", "slice ms", "total ms", "switches");
+    for (int i = 0; i < n; ++i) overhead(slices[i]);
+
+    printf("\nwake-up lateness after a 1 ms sleep, next to a hog yielding "
+           "every %d ms\n", BURST_NS / 1000000);
+    printf("%-12s %12s %12s %12s\n", "slice ms", "p50 us", "p99 us", "max us");
+    for (int i = 0; i < n; ++i) latency(slices[i]);
+    return 0;
+}
@@ -0,0 +1,68 @@
+// Tail latency of a latency-sensitive routine under a saturating load:
+// it sleeps SLEEP_NS SAMPLES times and records how late it gets to run
+// again, while LOAD routines keep the thread busy, each spinning for about
+// WORK_NS between co_yields. Three setups: everyone at normal priority,
+// the load at low and the latency routine at high priority, and the load
+// at low with the latency routine setting a deadline before every sleep.
+#include "../coroutine.h"
+#include "bench.h"
+
+#define LOAD (100)
+#define WORK_NS (2000)
+#define SAMPLES (1000)
+#define SLEEP_NS (1000000)
+#define SLACK_NS (100000)
+
+enum { ALL_NORMAL, HIGH_PRIO, DEADLINE };
+
+static int setup, stop;
+static long long late[SAMPLES];
+
+static int load_routine(void) {
+    if (setup != ALL_NORMAL) co_setprio(co_getid(), CO_PRIO_LOW);
+    while (!stop) {
+        long long until = now_ns() + WORK_NS;
+        while (now_ns() < until);
+        co_yield();
+    }
+    return 0;
+}
+
+static int latency_routine(void) {
+    if (setup == HIGH_PRIO) co_setprio(co_getid(), CO_PRIO_HIGH);
+    for (int i = 0; i < SAMPLES; ++i) {
+        if (setup == DEADLINE) co_setdeadline(co_getid(), SLEEP_NS + SLACK_NS);
+        long long wake = now_ns() + SLEEP_NS;
+        co_sleep(SLEEP_NS);
+        late[i] = now_ns() - wake;
+    }
+    return 0;
+}
+
+static int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return (x > y) - (x < y);
+}
+
+static void run(const char *name, int which) {
+    setup = which, stop = 0;
+    for (int i = 0; i < LOAD; ++i) co_release(co_start(load_routine));
+    int cid = co_start(latency_routine);
+    co_wait(cid);
+    co_release(cid);
+    stop = 1;
+    co_waitall();
+    qsort(late, SAMPLES, sizeof(late[0]), cmp_ll);
+    printf("%-12s %12.1f %12.1f %12.1f\n", name, late[SAMPLES / 2] / 1e3,
+           late[SAMPLES * 99 / 100] / 1e3, late[SAMPLES * 999 / 1000] / 1e3);
+}
+
+int main() {
+    printf("wake-up lateness after a %d us sleep, %d routines of load\n",
+           SLEEP_NS / 1000, LOAD);
+    printf("%-12s %12s %12s %12s\n", "", "p50 us", "p99 us", "p999 us");
+    run("all normal", ALL_NORMAL);
+    run("high prio", HIGH_PRIO);
+    run("deadline", DEADLINE);
+    return 0;
+}
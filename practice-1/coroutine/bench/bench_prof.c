@@ -0,0 +1,43 @@
+// Overhead of the profiler: time per co_yield round trip with it off, and 
+// on with several sampling periods (every switch then also reads the 
+// clock for the per-routine counters), the number of samples taken, and 
+// how long co_prof_dump takes to turn them into collapsed stacks.
+#include "../coroutine.h"
+#include "bench.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+#define ROUNDS (2000000)
+
+static int spinner(void) {
+    for (int i = 0; i < ROUNDS; ++i) co_yield();
+    return 0;
+}
+
+static void run(long long period) {
+    if (period > 0) co_prof_start(period);
+    int cid = co_start(spinner);
+    long long start = now_ns();
+    for (int i = 0; i < ROUNDS; ++i) co_yield();
+    long long elapsed = now_ns() - start;
+    co_wait(cid);
+    co_release(cid);
+    co_prof_stop();
+    int null = open("/dev/null", O_WRONLY);
+    long long dump = now_ns();
+    int samples = co_prof_dump(null, 0);
+    dump = now_ns() - dump;
+    close(null);
+    printf("%-12.1f %12.2f %12d %12.2f\n", period / 1e6, 
+           (double) elapsed / ROUNDS, samples, dump / 1e6);
+}
+
+int main() {
+    long long periods[] = {0, 10000000, 1000000, 100000};
+    int n = sizeof(periods) / sizeof(periods[0]);
+    printf("%d co_yield round trips\n", ROUNDS);
+    printf("%-12s %12s %12s %12s\n", "period ms", "ns/round", "samples", 
+           "dump ms");
+    for (int i = 0; i < n; ++i) run(periods[i]);
+    return 0;
+}
@@ -0,0 +1,80 @@
+// Stack tracking modes (fixed, track, adapt):
+// 1. ns per task for TASKS lazily spawned routines run to completion, 
+//    which in track and adapt mode includes measuring every stack;
+// 2. mapped and resident memory per idle routine: IDLE routines each park
+//    at a live stack depth of about DEPTH bytes, after as many of their 
+//    kind have run to completion and been measured.
+// Each mode runs in a process of its own: freed stacks stay mapped for 
+// later routines, and would be counted towards the first mode only.
+#include "../coroutine.h"
+#include "bench.h"
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define TASKS (100000)
+#define IDLE (10000)
+#define DEPTH (1024)
+
+static co_sem_t sem;
+static int parking;
+
+static void memory(long *mapped, long *resident) {
+    FILE *f = fopen("/proc/self/statm", "r");
+    *mapped = *resident = 0;
+    if (f == NULL) return;
+    if (fscanf(f, "%ld %ld", mapped, resident) != 2) *mapped = *resident = 0;
+    fclose(f);
+    *mapped *= sysconf(_SC_PAGESIZE), *resident *= sysconf(_SC_PAGESIZE);
+}
+
+static int task(void *arg) {
+    volatile char frame[DEPTH];
+    memset((char *) frame, 1, DEPTH);
+    if (parking) co_sem_wait(&sem);
+    return frame[0];
+}
+
+static void run(const char *name, int mode) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid != 0) {
+        if (pid > 0) waitpid(pid, NULL, 0);
+        return;
+    }
+    co_set_stack_mode(mode);
+    // the first round teaches adapt mode the tasks' depth
+    parking = 0;
+    co_spawn_n(task, NULL, TASKS, NULL);
+    co_waitall();
+    long long start = now_ns();
+    co_spawn_n(task, NULL, TASKS, NULL);
+    co_waitall();
+    double ns = (double) (now_ns() - start) / TASKS;
+
+    parking = 1;
+    co_sem_init(&sem, 0);
+    long mapped, resident, mapped_idle, resident_idle;
+    memory(&mapped, &resident);
+    co_spawn_n(task, NULL, IDLE, NULL);
+    // let every one of them run up to its co_sem_wait
+    co_yield();
+    memory(&mapped_idle, &resident_idle);
+    for (int i = 0; i < IDLE; ++i) co_sem_post(&sem);
+    co_waitall();
+    co_set_stack_mode(CO_STACK_FIXED);
+    printf("%-8s %12.1f %16.1f %16.1f\n", name, ns, 
+           (double) (mapped_idle - mapped) / IDLE / 1024, 
+           (double) (resident_idle - resident) / IDLE / 1024);
+    exit(0);
+}
+
+int main() {
+    printf("%d tasks, then %d idle ones %d bytes deep\n", TASKS, IDLE, DEPTH);
+    printf("%-8s %12s %16s %16s\n", "mode", "ns/task", "mapped KB/idle", 
+           "resident KB/idle");
+    run("fixed", CO_STACK_FIXED);
+    run("track", CO_STACK_TRACK);
+    run("adapt", CO_STACK_ADAPT);
+    return 0;
+}
@@ -0,0 +1,31 @@
+// Cost of a co_yield round trip (main -> coroutine -> main) with the context
+// switch backend this binary was built with: bench_switch uses the default
+// one, bench_switch_ucontext is built with -DCO_USE_UCONTEXT.
+#include "../coroutine.h"
+#include "bench.h"
+
+#define ROUNDS (2000000)
+
+#ifdef CO_USE_UCONTEXT
+#define BACKEND "ucontext"
+#elif defined(__x86_64__)
+#define BACKEND "x86-64 asm"
+#else
+#define BACKEND "ucontext (fallback)"
+#endif
+
+static int spinner(void) {
+    for (int i = 0; i < ROUNDS; ++i) co_yield();
+    return 0;
+}
+
+int main() {
+    int cid = co_start(spinner);
+    long long start = now_ns();
+    for (int i = 0; i < ROUNDS; ++i) co_yield();
+    long long elapsed = now_ns() - start;
+    co_wait(cid);
+    printf("%-20s %8.2f ns per co_yield round trip\n", 
+        BACKEND, (double) elapsed / ROUNDS);
+    return 0;
+}
@@ -0,0 +1,139 @@
+// co_mutex/co_cond/co_sem against the pthread primitives of practice 1-1
+// (task2-task4), in ns per operation:
+// 1. mutex: PARTIES parties bump a shared counter under the lock, giving
+//    up the CPU inside the critical section every YIELD_EVERY ops, so that
+//    the lock is held by someone who isn't running (sched_yield for
+//    threads, co_yield for routines on one thread);
+// 2. cond: two parties take turns on a flag with a mutex and a condition
+//    variable, as task4 does;
+// 3. sem: two parties ping-pong through a pair of semaphores.
+#include "../coroutine.h"
+#include "bench.h"
+#include <sched.h>
+#include <semaphore.h>
+
+#define PARTIES (8)
+#define MUTEX_OPS (100000)
+#define YIELD_EVERY (16)
+#define TURNS (100000)
+
+static long counter;
+static int turn;
+
+static pthread_mutex_t p_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t p_cond = PTHREAD_COND_INITIALIZER;
+static sem_t p_sems[2];
+static co_mutex_t c_mutex;
+static co_cond_t c_cond;
+static co_sem_t c_sems[2];
+
+static void *p_mutex_party(void *arg) {
+    for (int i = 0; i < MUTEX_OPS; ++i) {
+        pthread_mutex_lock(&p_mutex);
+        counter++;
+        if (i % YIELD_EVERY == 0) sched_yield();
+        pthread_mutex_unlock(&p_mutex);
+    }
+    return NULL;
+}
+
+static int c_mutex_party(void) {
+    for (int i = 0; i < MUTEX_OPS; ++i) {
+        co_mutex_lock(&c_mutex);
+        counter++;
+        if (i % YIELD_EVERY == 0) co_yield();
+        co_mutex_unlock(&c_mutex);
+    }
+    return 0;
+}
+
+static void *p_cond_party(void *arg) {
+    int me = (int) (long) arg;
+    for (int i = 0; i < TURNS / 2; ++i) {
+        pthread_mutex_lock(&p_mutex);
+        while (turn % 2 != me) pthread_cond_wait(&p_cond, &p_mutex);
+        turn++;
+        pthread_cond_broadcast(&p_cond);
+        pthread_mutex_unlock(&p_mutex);
+    }
+    return NULL;
+}
+
+static int c_party_id;
+
+static int c_cond_party(void) {
+    int me = c_party_id++;
+    for (int i = 0; i < TURNS / 2; ++i) {
+        co_mutex_lock(&c_mutex);
+        while (turn % 2 != me) co_cond_wait(&c_cond, &c_mutex);
+        turn++;
+        co_cond_broadcast(&c_cond);
+        co_mutex_unlock(&c_mutex);
+    }
+    return 0;
+}
+
+static void *p_sem_party(void *arg) {
+    int me = (int) (long) arg;
+    for (int i = 0; i < TURNS / 2; ++i) {
+        sem_wait(&p_sems[me]);
+        sem_post(&p_sems[!me]);
+    }
+    return NULL;
+}
+
+static int c_sem_party(void) {
+    int me = c_party_id++;
+    for (int i = 0; i < TURNS / 2; ++i) {
+        co_sem_wait(&c_sems[me]);
+        co_sem_post(&c_sems[!me]);
+    }
+    return 0;
+}
+
+static double run_threads(int n, void *(*party)(void *)) {
+    pthread_t threads[PARTIES];
+    long long start = now_ns();
+    for (int i = 0; i < n; ++i)
+        pthread_create(threads + i, NULL, party, (void *) (long) i);
+    for (int i = 0; i < n; ++i) pthread_join(threads[i], NULL);
+    return now_ns() - start;
+}
+
+static double run_routines(int n, int (*party)(void)) {
+    int cids[PARTIES];
+    c_party_id = 0;
+    long long start = now_ns();
+    for (int i = 0; i < n; ++i) cids[i] = co_start(party);
+    for (int i = 0; i < n; ++i) co_wait(cids[i]), co_release(cids[i]);
+    return now_ns() - start;
+}
+
+static void report(const char *name, double p_ns, double c_ns, long ops) {
+    printf("%-8s %16.1f %16.1f\n", name, p_ns / ops, c_ns / ops);
+}
+
+int main() {
+    printf("%-8s %16s %16s\n", "", "pthread ns/op", "coroutine ns/op");
+
+    counter = 0;
+    double p_ns = run_threads(PARTIES, p_mutex_party);
+    co_mutex_init(&c_mutex);
+    double c_ns = run_routines(PARTIES, c_mutex_party);
+    if (counter != 2L * PARTIES * MUTEX_OPS) printf("(mutex count wrong)\n");
+    report("mutex", p_ns, c_ns, (long) PARTIES * MUTEX_OPS);
+
+    turn = 0;
+    p_ns = run_threads(2, p_cond_party);
+    turn = 0;
+    co_cond_init(&c_cond);
+    c_ns = run_routines(2, c_cond_party);
+    report("cond", p_ns, c_ns, TURNS);
+
+    sem_init(&p_sems[0], 0, 1), sem_init(&p_sems[1], 0, 0);
+    p_ns = run_threads(2, p_sem_party);
+    co_sem_init(&c_sems[0], 1), co_sem_init(&c_sems[1], 0);
+    c_ns = run_routines(2, c_sem_party);
+    report("sem", p_ns, c_ns, TURNS);
+    return 0;
+}
@@ -0,0 +1,55 @@
+// Per-thread switch cost as the number of threads using the library grows.
+// Every thread registers with the scheduler first, then measures (in its own
+// cpu time, so the numbers stay meaningful when threads share a core)
+// the cost of co_getid, which only looks up the thread's meta information,
+// and of a co_yield round trip between the thread's main routine and one
+// coroutine.
+#include "../coroutine.h"
+#include "bench.h"
+#include <pthread.h>
+
+#define ROUNDS (20000)
+
+static pthread_barrier_t barrier;
+static double getid_ns[128], yield_ns[128];
+
+static int spinner(void) {
+    for (int i = 0; i < ROUNDS; ++i) co_yield();
+    return 0;
+}
+
+static void *worker(void *arg) {
+    long idx = (long) arg;
+    int cid = co_start(spinner);
+    pthread_barrier_wait(&barrier);
+
+    long long start = thread_ns();
+    volatile int sink = 0;
+    for (int i = 0; i < ROUNDS; ++i) sink += co_getid();
+    getid_ns[idx] = (double) (thread_ns() - start) / ROUNDS;
+
+    start = thread_ns();
+    for (int i = 0; i < ROUNDS; ++i) co_yield();
+    yield_ns[idx] = (double) (thread_ns() - start) / ROUNDS;
+
+    co_wait(cid);
+    pthread_barrier_wait(&barrier);
+    return NULL;
+}
+
+int main() {
+    pthread_t threads[128];
+    printf("%8s %14s %14s\n", "threads", "getid(ns)", "yield(ns)");
+    for (int n = 1; n <= 128; n <<= 1) {
+        pthread_barrier_init(&barrier, NULL, n);
+        for (long i = 0; i < n; ++i)
+            pthread_create(threads + i, NULL, worker, (void *) i);
+        for (int i = 0; i < n; ++i) pthread_join(threads[i], NULL);
+        pthread_barrier_destroy(&barrier);
+
+        double getid = 0, yield = 0;
+        for (int i = 0; i < n; ++i) getid += getid_ns[i], yield += yield_ns[i];
+        printf("%8d %14.2f %14.2f\n", n, getid / n, yield / n);
+    }
+    return 0;
+}
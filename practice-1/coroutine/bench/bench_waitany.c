@@ -0,0 +1,59 @@
+// Hedged fan-out on one thread: k sub-tasks are spawned, one finishes 
+// FAST_NS after the fan-out starts and the others SLOW_NS after it, and 
+// the caller joins whichever finishes first, then all of them. Joining 
+// the first one by polling co_status over every task with a co_yield 
+// between passes, against co_wait_any; the rest are joined by a co_wait 
+// each, against co_wait_all_of. Shows wall and cpu time per fan-out, and 
+// the co_status calls polling took.
+#include "../coroutine.h"
+#include "bench.h"
+
+#define ROUNDS (50)
+#define FAST_NS (1000000)
+#define SLOW_NS (3000000)
+
+static cid_t cids[256];
+static long long polls, start_ns;
+
+static int task(void *arg) {
+    co_sleep(start_ns + (long) arg - now_ns());
+    return 0;
+}
+
+static void spawn(int k) {
+    start_ns = now_ns();
+    for (int i = 0; i < k; ++i) 
+        cids[i] = co_spawn(task, (void *) (long) (i == k / 2? FAST_NS: SLOW_NS));
+}
+
+static int first_by_polling(int k) {
+    for (;;) {
+        for (int i = 0; i < k; ++i, ++polls) 
+            if (co_status(cids[i]) == FINISHED) return i;
+        co_yield();
+    }
+}
+
+static void run(int k, int parking) {
+    polls = 0;
+    long long start = now_ns(), cpu = thread_ns();
+    for (int r = 0; r < ROUNDS; ++r) {
+        spawn(k);
+        if (parking) co_wait_any(cids, k, NULL), co_wait_all_of(cids, k);
+        else {
+            first_by_polling(k);
+            for (int i = 0; i < k; ++i) co_wait(cids[i]);
+        }
+        for (int i = 0; i < k; ++i) co_release(cids[i]);
+    }
+    printf("%-8d %-10s %12.1f %12.1f %12lld\n", k, parking? "wait_any": "polling",
+           (now_ns() - start) / 1e3 / ROUNDS, (thread_ns() - cpu) / 1e3 / ROUNDS,
+           polls / ROUNDS);
+}
+
+int main() {
+    printf("%-8s %-10s %12s %12s %12s\n", "tasks", "join", "wall us", "cpu us", 
+           "co_status");
+    for (int k = 4; k <= 256; k *= 4) run(k, 0), run(k, 1);
+    return 0;
+}
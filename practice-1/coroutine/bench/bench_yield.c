@@ -0,0 +1,41 @@
+// Cost of a single co_yield as the number of live coroutines on the thread
+// grows. Every coroutine keeps yielding until the main routine stops them,
+// so the run queue holds all of them during the measurement.
+#include "../coroutine.h"
+#include "bench.h"
+
+#define SWITCHES (2000000LL)
+
+static long long switches;
+static int stop;
+
+static int spinner(void) {
+    while (!stop) ++switches, co_yield();
+    return 0;
+}
+
+int main() {
+    printf("%10s %14s\n", "coroutines", "yield(ns)");
+    for (int n = 1; n <= 100000; n *= 10) {
+        stop = 0;
+        int started = 0;
+        while (started < n && co_start(spinner) >= 0) ++started;
+        if (started < n) {
+            printf("%10d %14s\n", n, "co_start failed");
+            stop = 1;
+            co_waitall();
+            break;
+        }
+
+        switches = 0;
+        long long start = now_ns();
+        while (switches < SWITCHES) co_yield();
+        long long elapsed = now_ns() - start;
+        // main yields once per pass over the run queue
+        printf("%10d %14.2f\n", n, (double) elapsed / (switches + switches / n));
+
+        stop = 1;
+        co_waitall();
+    }
+    return 0;
+}
@@ -1,393 +1,3937 @@
 #include "coroutine.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <link.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 
-typedef pthread_rwlock_t co_lock_t;
-#define RDLOCK(lock) pthread_rwlock_rdlock(lock)
-#define WRLOCK(lock) pthread_rwlock_wrlock(lock)
-#define UNLOCK(lock) pthread_rwlock_unlock(lock)
-#define INITLOCK(lock, attr) pthread_rwlock_init(lock, attr)
+// a tiny test-and-test-and-set spinlock, for critical sections 
+// that are only a few instructions long
+typedef _Atomic int co_spin_t;
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#else
+#define CPU_RELAX() ((void) 0)
+#endif
+
+#define CO_SPIN_LIMIT (128)
+    // spins before giving the CPU away, a preempted lock holder (more 
+    // threads than cores) would otherwise be waited for a whole time slice
+
+static inline void co_spin_relax(int *spins) {
+    if (++*spins < CO_SPIN_LIMIT) CPU_RELAX();
+    else *spins = 0, sched_yield();
+}
+
+static inline void co_spin_lock(co_spin_t *lock) {
+    int spins = 0;
+    while (atomic_exchange_explicit(lock, 1, memory_order_acquire))
+        while (atomic_load_explicit(lock, memory_order_relaxed)) 
+            co_spin_relax(&spins);
+}
+static inline void co_spin_unlock(co_spin_t *lock) {
+    atomic_store_explicit(lock, 0, memory_order_release);
+}
 
 typedef void co_arg_t;
 typedef int co_ret_t;
 typedef co_ret_t (*co_func_t)(co_arg_t);
 typedef int co_status_t;
 
-/* Implementation of Array List */
+/* Implementation of Segmented Registry */
+
+// An append-only array of pointers, made of segments of doubling size 
+// (segment k holds REGISTRY_SEG0 << k entries). Segments are never moved 
+// or freed once published, thus lookups are wait-free (two loads) and 
+// insertions are lock-free, no matter how many threads use it at once.
+
+#define REGISTRY_SEG0_BITS (10)
+#define REGISTRY_SEG0 (1 << REGISTRY_SEG0_BITS)
+#define REGISTRY_SEGMENTS (11)
+#define REGISTRY_CAP (REGISTRY_SEG0 * ((1 << REGISTRY_SEGMENTS) - 1))
+
+typedef void* co_registry_value_t;
+
+typedef struct co_registry_t {
+    _Atomic int len;
+        // number of indices handed out
+    _Atomic(co_registry_value_t *) seg[REGISTRY_SEGMENTS];
+} co_registry_t;
+
+static inline co_registry_value_t *co_registry_slot(co_registry_t *reg, 
+                                                    int idx, int create) {
+    int k = 31 - __builtin_clz((idx >> REGISTRY_SEG0_BITS) + 1);
+    int off = idx - (((1 << k) - 1) << REGISTRY_SEG0_BITS);
+    co_registry_value_t *seg = 
+        atomic_load_explicit(&reg->seg[k], memory_order_acquire);
+    if (seg == NULL) {
+        if (!create) return NULL;
+        co_registry_value_t *new_seg = (co_registry_value_t *) 
+            calloc(REGISTRY_SEG0 << k, sizeof(co_registry_value_t));
+        // another thread may publish the segment first
+        if (atomic_compare_exchange_strong(&reg->seg[k], &seg, new_seg)) 
+            seg = new_seg;
+        else free(new_seg);
+    }
+    return seg + off;
+}
+
+// hand out up to *n consecutive indices below cap, setting *n to how 
+// many; returns the first one, -1 if there is none left
+static int co_registry_reserve(co_registry_t *reg, int *n, int cap) {
+    int idx = atomic_load_explicit(&reg->len, memory_order_relaxed);
+    do {
+        if (idx >= cap) return -1;
+        if (*n > cap - idx) *n = cap - idx;
+    } while (!atomic_compare_exchange_weak(&reg->len, &idx, idx + *n));
+    return idx;
+}
+
+// publish the value of an index handed out by co_registry_reserve
+static inline void co_registry_put(co_registry_t *reg, int idx, 
+                                   co_registry_value_t value) {
+    __atomic_store_n(co_registry_slot(reg, idx, 1), value, __ATOMIC_RELEASE);
+}
+
+// NULL if idx hasn't been handed out (or its value isn't published yet)
+static inline co_registry_value_t co_registry_get(co_registry_t *reg, int idx) {
+    co_registry_value_t *slot = co_registry_slot(reg, idx, 0);
+    return slot != NULL? __atomic_load_n(slot, __ATOMIC_ACQUIRE): NULL;
+}
+
+// values are freed too if they were malloc'd one by one
+static void co_registry_destroy(co_registry_t *reg, int free_values) {
+    for (int k = 0; k < REGISTRY_SEGMENTS; ++k) {
+        co_registry_value_t *seg = reg->seg[k];
+        if (seg == NULL) continue;
+        for (int i = 0; free_values && i < (REGISTRY_SEG0 << k); ++i) 
+            free(seg[i]);
+        free(seg);
+        reg->seg[k] = NULL;
+    }
+    reg->len = 0;
+}
+
+/* Implementation of Context Switch */
+
+// Two backends are available:
+// 1. (default on x86-64) a hand-written switch that only saves callee-saved 
+//    registers, the stack pointer and the fp control words, and leaves the 
+//    signal mask alone, thus never enters the kernel;
+// 2. ucontext (swapcontext/makecontext), which also saves/restores the 
+//    signal mask with a rt_sigprocmask syscall on every switch.
+//    Build with -DCO_USE_UCONTEXT to force this one.
+// A new context starts at entry() on the given stack, entry() must never 
+// return, it switches away instead.
+
+#if defined(__x86_64__) && !defined(CO_USE_UCONTEXT)
+#define CO_CTX_ASM
+
+typedef struct co_ctx_t {
+    void *sp;
+        // saved stack pointer, callee-saved registers live on the stack
+} co_ctx_t;
+
+void _co_ctx_swap(co_ctx_t *from, co_ctx_t *to) 
+    __attribute__((visibility("hidden")));
+void _co_ctx_entry(void) __attribute__((visibility("hidden")));
+extern char _co_ctx_entry_ret[] __attribute__((visibility("hidden")));
+    // return address of the entry() call, at the bottom of every stack
+
+// frame layout (from low to high address):
+// mxcsr, x87 cw | r15 | r14 | r13 | r12 | rbx | rbp | return address
+__asm__(
+    ".text\n"
+    ".globl _co_ctx_swap\n"
+    ".type _co_ctx_swap, @function\n"
+    "_co_ctx_swap:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq (%rsi), %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size _co_ctx_swap, .-_co_ctx_swap\n"
+    // first return of a new context lands here with entry() in r12,
+    // rip is marked undefined so that unwinders stop at this frame
+    ".globl _co_ctx_entry\n"
+    ".type _co_ctx_entry, @function\n"
+    "_co_ctx_entry:\n"
+    "    .cfi_startproc\n"
+    "    .cfi_undefined rip\n"
+    "    callq *%r12\n"
+    ".globl _co_ctx_entry_ret\n"
+    "_co_ctx_entry_ret:\n"
+    "    ud2\n"
+    "    .cfi_endproc\n"
+    ".size _co_ctx_entry, .-_co_ctx_entry\n"
+);
+
+static void _co_ctx_make(co_ctx_t *ctx, void *stack, size_t size, 
+                         void (*entry)(void)) {
+    // keep the stack 16-byte aligned at the call in _co_ctx_entry
+    unsigned long top = ((unsigned long) stack + size) & ~15UL;
+    void **frame = (void **) (top - 80);
+    ((unsigned int *) frame)[0] = 0x1F80;   // default mxcsr
+    ((unsigned int *) frame)[1] = 0x037F;   // default x87 control word
+    frame[1] = NULL;                        // r15
+    frame[2] = NULL;                        // r14
+    frame[3] = NULL;                        // r13
+    frame[4] = (void *) entry;              // r12
+    frame[5] = NULL;                        // rbx
+    frame[6] = NULL;                        // rbp
+    frame[7] = (void *) _co_ctx_entry;      // return address
+    ctx->sp = frame;
+}
+
+#else
+
+typedef struct co_ctx_t {
+    ucontext_t uc;
+} co_ctx_t;
+
+static void _co_ctx_make(co_ctx_t *ctx, void *stack, size_t size, 
+                         void (*entry)(void)) {
+    getcontext(&ctx->uc);
+    ctx->uc.uc_link = NULL;
+    ctx->uc.uc_stack.ss_sp = stack;
+    ctx->uc.uc_stack.ss_size = size;
+    makecontext(&ctx->uc, entry, 0);
+}
+
+static inline void _co_ctx_swap(co_ctx_t *from, co_ctx_t *to) {
+    swapcontext(&from->uc, &to->uc);
+}
+
+#endif
+
+/* Implementation of Stack Pool */
+
+// Stacks are carved out of chunks, mappings of about CO_STACK_CHUNK bytes 
+// holding stacks of one size one after another, each right above a guard 
+// page so that an overflow faults instead of corrupting memory silently. 
+// A mapping per stack, split in two by an mprotect'd guard page, would 
+// cap live routines at vm.max_map_count / 2 (~32k by default). Guard 
+// pages are thus installed with MADV_GUARD_INSTALL, which leaves the 
+// chunk a single mapping; on kernels without it, the first 
+// CO_STACK_GUARDS_MAX are mprotect'd, and later stacks go without.
+// Sizes are rounded up to a power-of-two number of pages (a size class),
+// and stacks of finished routines are cached in per-thread free lists 
+// by class, thus steady-state spawning makes no syscall. A chunk can't be 
+// unmapped piecewise: a stack past the cache has its pages dropped and 
+// goes to a process-wide list by class, taken from before mapping more.
+
+#define CO_STACK_CLASSES (16)
+#define CO_STACK_CACHE_MAX (256)
+    // max number of cached stacks per class and thread
+#define CO_STACK_CHUNK (4 * 1024 * 1024)
+    // bytes mapped at once for stacks, unless a single one takes more
+#define CO_STACK_GUARDS_MAX (16 * 1024)
+    // mprotect'd guard pages at most, each adds two mappings
+
+#ifndef MADV_GUARD_INSTALL
+#define MADV_GUARD_INSTALL (102)
+#endif
+
+typedef struct co_stack_t co_stack_t;
+typedef struct co_stack_pool_t co_stack_pool_t;
+typedef struct co_stack_chunk_t co_stack_chunk_t;
+
+// link of a cached stack, stored at its highest address, which its next
+// user touches first anyway, so that caching it touches no other page
+struct co_stack_t {
+    co_stack_t *next;
+    int dirty;
+        // unset if its resident pages hold the canary, see Stack Tracking
+};
+
+// per-thread cache of free stacks
+struct co_stack_pool_t {
+    co_stack_t *free[CO_STACK_CLASSES];
+    int count[CO_STACK_CLASSES];
+    char *carve[CO_STACK_CLASSES];
+    int carve_left[CO_STACK_CLASSES];
+        // next slot (guard page first) of the last chunk the thread 
+        // mapped for the class, and the slots left in it
+};
+
+// a mapping stacks are carved out of, unmapped with the scheduler only
+struct co_stack_chunk_t {
+    co_stack_chunk_t *next;
+    void *base;
+    size_t size;
+};
+
+static size_t _co_page_size;
+static _Atomic size_t _co_stack_size = DEFAULT_STACK_SIZE;
+static _Atomic size_t _co_shared_stack_size;
+    // size of the shared stacks of copy-stack mode, 0 while it is off
+static _Atomic int _co_stack_mode = CO_STACK_FIXED;
+#define CO_COPIER_STACK (16 * 1024)
+    // stack of the context copying frames in copy-stack mode
+static co_spin_t _co_stack_lock;
+static co_stack_t *_co_stack_free[CO_STACK_CLASSES];
+static co_stack_chunk_t *_co_stack_chunks;
+    // stacks given up by threads, and every chunk, under _co_stack_lock
+static _Atomic int _co_stack_guards;
+    // -1 once MADV_GUARD_INSTALL works, mprotect'd guard pages otherwise
+
+static int co_stack_class(size_t size) {
+    int cls = 0;
+    while ((_co_page_size << cls) < size) ++cls;
+    return cls;
+}
+
+static inline co_stack_t *co_stack_link(void *ptr, size_t size) {
+    return (co_stack_t *) ((char *) ptr + size) - 1;
+}
+
+// make page the guard of the stack above it, if guards are left
+static void co_stack_guard(char *page) {
+    int guards = atomic_load_explicit(&_co_stack_guards, memory_order_relaxed);
+    if (guards <= 0 && madvise(page, _co_page_size, MADV_GUARD_INSTALL) == 0) {
+        if (guards == 0) atomic_store(&_co_stack_guards, -1);
+        return;
+    }
+    if (guards >= 0 && guards < CO_STACK_GUARDS_MAX && 
+        mprotect(page, _co_page_size, PROT_NONE) == 0) 
+        atomic_fetch_add(&_co_stack_guards, 1);
+}
+
+// a stack of class cls never used, from the chunk of the thread
+static void *co_stack_carve(co_stack_pool_t *pool, int cls) {
+    size_t stride = (_co_page_size << cls) + _co_page_size;
+    if (pool->carve_left[cls] == 0) {
+        int slots = CO_STACK_CHUNK / stride > 0? CO_STACK_CHUNK / stride: 1;
+        co_stack_chunk_t *chunk = 
+            (co_stack_chunk_t *) malloc(sizeof(co_stack_chunk_t));
+        if (chunk == NULL) return NULL;
+        chunk->size = slots * stride;
+        chunk->base = mmap(NULL, chunk->size, PROT_READ | PROT_WRITE, 
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (chunk->base == MAP_FAILED) {
+            free(chunk);
+            return NULL;
+        }
+        // a huge page would make a few touched stack pages resident at once
+        madvise(chunk->base, chunk->size, MADV_NOHUGEPAGE);
+        for (int i = 0; i < slots; ++i) 
+            co_stack_guard((char *) chunk->base + i * stride);
+        co_spin_lock(&_co_stack_lock);
+        chunk->next = _co_stack_chunks;
+        _co_stack_chunks = chunk;
+        co_spin_unlock(&_co_stack_lock);
+        pool->carve[cls] = (char *) chunk->base;
+        pool->carve_left[cls] = slots;
+    }
+    char *stack = pool->carve[cls] + _co_page_size;
+    pool->carve[cls] += stride;
+    pool->carve_left[cls]--;
+    return stack;
+}
+
+// hand a free stack over to every thread, its pages dropped if used
+static void co_stack_give(void *ptr, size_t size, int used) {
+    // the page of the link is touched anyway
+    if (used) madvise(ptr, size - _co_page_size, MADV_DONTNEED);
+    co_stack_t *link = co_stack_link(ptr, size);
+    link->dirty = used;
+    int cls = co_stack_class(size);
+    co_spin_lock(&_co_stack_lock);
+    link->next = _co_stack_free[cls];
+    _co_stack_free[cls] = link;
+    co_spin_unlock(&_co_stack_lock);
+}
+
+// returns the lowest usable address of a stack with at least
+// *size bytes, and sets *size to the actual size
+static void *co_stack_alloc(co_stack_pool_t *pool, size_t *size) {
+    int cls = co_stack_class(*size);
+    if (cls >= CO_STACK_CLASSES) return NULL;
+    *size = _co_page_size << cls;
+    co_stack_t *link = pool->free[cls];
+    if (link != NULL) {
+        pool->free[cls] = link->next;
+        pool->count[cls]--;
+        return (char *) (link + 1) - *size;
+    }
+    if (__atomic_load_n(&_co_stack_free[cls], __ATOMIC_RELAXED) != NULL) {
+        co_spin_lock(&_co_stack_lock);
+        link = _co_stack_free[cls];
+        if (link != NULL) _co_stack_free[cls] = link->next;
+        co_spin_unlock(&_co_stack_lock);
+        if (link != NULL) return (char *) (link + 1) - *size;
+    }
+    return co_stack_carve(pool, cls);
+}
+
+// dirty tells whether the stack may hold other than the canary 
+// (its link aside)
+static void co_stack_free(co_stack_pool_t *pool, void *ptr, size_t size, 
+                          int dirty) {
+    int cls = co_stack_class(size);
+    if (pool->count[cls] < CO_STACK_CACHE_MAX) {
+        co_stack_t *link = co_stack_link(ptr, size);
+        link->dirty = dirty;
+        link->next = pool->free[cls];
+        pool->free[cls] = link;
+        pool->count[cls]++;
+    }
+    else co_stack_give(ptr, size, 1);
+}
+
+// hand the stacks of an exiting thread over to the others
+static void co_stack_pool_destroy(co_stack_pool_t *pool) {
+    for (int cls = 0; cls < CO_STACK_CLASSES; ++cls) {
+        size_t size = _co_page_size << cls;
+        while (pool->free[cls] != NULL) {
+            co_stack_t *link = pool->free[cls];
+            pool->free[cls] = link->next;
+            co_stack_give((char *) (link + 1) - size, size, 1);
+        }
+        pool->count[cls] = 0;
+        for (; pool->carve_left[cls] > 0; pool->carve_left[cls]--) {
+            co_stack_give(pool->carve[cls] + _co_page_size, size, 0);
+            pool->carve[cls] += size + _co_page_size;
+        }
+    }
+}
+
+static void co_stack_chunks_destroy() {
+    co_spin_lock(&_co_stack_lock);
+    for (co_stack_chunk_t *next; _co_stack_chunks != NULL; 
+         _co_stack_chunks = next) {
+        next = _co_stack_chunks->next;
+        munmap(_co_stack_chunks->base, _co_stack_chunks->size);
+        free(_co_stack_chunks);
+    }
+    memset(_co_stack_free, 0, sizeof(_co_stack_free));
+    co_spin_unlock(&_co_stack_lock);
+}
+
+int co_set_stack_size(size_t size) {
+    if (size == 0) return -1;
+    _co_stack_size = size;
+    return 0;
+}
+
+int co_set_shared_stack(size_t size) {
+#ifdef CO_CTX_ASM
+    _co_shared_stack_size = size;
+    return 0;
+#else
+    // the live part of a stack is found through the saved stack pointer
+    return -1;
+#endif
+}
+
+/* Implementation of Stack Tracking */
+
+// A routine to be measured gets a stack whose resident pages all hold 
+// CO_STACK_CANARY: a fresh one has none, a cached one whose last user was 
+// measured was painted back, and any other has its pages dropped. Pages 
+// never touched thus stay unmapped. When the stack of a finished routine 
+// is released, the lowest resident page is found with mincore, and the 
+// lowest word above it not holding the canary is the high-water mark of 
+// the routine. Zero can't be the canary, frames full of zeros would look 
+// unused: a page the routine touched first reads zero where it didn't 
+// write, and counts as used from its bottom, which errs by less than a 
+// page and only upwards. The resident part is then painted again, and the 
+// mark goes to the statistics of its entry function. A histogram of the 
+// size classes the marks (plus headroom) fall in gives the stack size of 
+// later routines with the same entry in CO_STACK_ADAPT mode, which only 
+// goes on measuring one in CO_STACK_SAMPLING of them afterwards. 
+// Statistics live in a fixed open-addressing table, updated and read 
+// without a lock.
+
+#define CO_STACK_ENTRIES (256)
+    // distinct entry functions tracked, later ones are left out
+#define CO_STACK_HEADROOM (8 * 1024)
+    // added to the marks, for deeper paths and signal handlers
+#define CO_STACK_PERCENTILE (99)
+#define CO_STACK_MIN_SAMPLES (16)
+    // marks needed before an entry gets a stack size of its own
+#define CO_STACK_SAMPLING (16)
+#define CO_STACK_CANARY (0x5a)
+    // byte painted over measured stacks
+#define CO_STACK_CANARY_WORD (~0UL / 0xff * CO_STACK_CANARY)
+
+typedef struct co_stack_entry_t {
+    _Atomic(void *) entry;
+    _Atomic long long count;
+    _Atomic long long total;
+    _Atomic size_t max;
+        // marks recorded, their sum and the highest one
+    _Atomic long long classes[CO_STACK_CLASSES];
+        // marks per size class covering them with headroom
+    _Atomic size_t size;
+        // stack size in CO_STACK_ADAPT mode, 0 until enough marks
+} co_stack_entry_t;
+
+static co_stack_entry_t _co_stack_entries[CO_STACK_ENTRIES];
+
+// statistics of entry, added if create is set and there is room
+static co_stack_entry_t *co_stack_entry(void *entry, int create) {
+    unsigned long hash = ((unsigned long) entry >> 4) * 0x9E3779B97F4A7C15UL;
+    for (int i = 0; i < CO_STACK_ENTRIES; ++i) {
+        co_stack_entry_t *e = 
+            &_co_stack_entries[(hash + i) % CO_STACK_ENTRIES];
+        void *key = atomic_load_explicit(&e->entry, memory_order_acquire);
+        if (key == entry) return e;
+        if (key != NULL) continue;
+        if (!create) return NULL;
+        if (atomic_compare_exchange_strong(&e->entry, &key, entry) || 
+            key == entry) return e;
+    }
+    return NULL;
+}
+
+// lowest resident address of [stack, stack + size)
+static char *co_stack_resident(void *stack, size_t size) {
+    char *base = (char *) stack;
+    unsigned char resident[64];
+    size_t pages = size / _co_page_size;
+    for (size_t i = 0; i < pages; i += sizeof(resident)) {
+        size_t n = pages - i < sizeof(resident)? pages - i: sizeof(resident);
+        if (mincore(base + i * _co_page_size, n * _co_page_size, 
+                    resident) < 0) return base + i * _co_page_size;
+        for (size_t j = 0; j < n; ++j) 
+            if (resident[j] & 1) return base + (i + j) * _co_page_size;
+    }
+    return base + size;
+}
+
+// bytes of [bottom, top) written since it held the canary
+static size_t co_stack_used(char *bottom, char *top) {
+    unsigned long *word = (unsigned long *) bottom;
+    while ((char *) word < top && *word == CO_STACK_CANARY_WORD) ++word;
+    return top - (char *) word;
+}
 
-typedef void* co_array_value_t;
+// measure the stack of a finished routine started at entry, and paint it 
+// again
+static __attribute__((noinline)) 
+void co_stack_track(void *entry, void *stack, size_t size) {
+    char *bottom = co_stack_resident(stack, size), *top = (char *) stack + size;
+    size_t used = co_stack_used(bottom, top);
+    memset(bottom, CO_STACK_CANARY, top - bottom);
+    co_stack_entry_t *e = co_stack_entry(entry, 1);
+    if (e == NULL) return;
+    long long count = atomic_fetch_add(&e->count, 1) + 1;
+    atomic_fetch_add(&e->total, used);
+    size_t max = atomic_load(&e->max);
+    while (used > max && !atomic_compare_exchange_weak(&e->max, &max, used));
+    int cls = co_stack_class(used + CO_STACK_HEADROOM);
+    if (cls >= CO_STACK_CLASSES) cls = CO_STACK_CLASSES - 1;
+    atomic_fetch_add(&e->classes[cls], 1);
+    if (count < CO_STACK_MIN_SAMPLES) return;
+    // smallest class covering the percentile
+    long long covered = 0;
+    for (cls = 0; cls < CO_STACK_CLASSES - 1; ++cls) {
+        covered += atomic_load_explicit(&e->classes[cls], 
+                                        memory_order_relaxed);
+        if (covered * 100 >= count * CO_STACK_PERCENTILE) break;
+    }
+    atomic_store(&e->size, _co_page_size << cls);
+}
 
-typedef struct co_array_t {
-    size_t len;
-    size_t cap;
-    co_array_value_t *data;
-} co_array_t;
+// stack size of a new routine started at entry, and whether it is 
+// measured (*track), picked at random through seed once it is sampled
+static inline size_t co_stack_size_for(void *entry, unsigned int *seed, 
+                                       int *track) {
+    size_t size = _co_stack_size;
+    int mode = _co_stack_mode;
+    *track = mode != CO_STACK_FIXED;
+    if (__builtin_expect(mode == CO_STACK_ADAPT, 0)) {
+        co_stack_entry_t *e = co_stack_entry(entry, 0);
+        size_t adapted = e != NULL? atomic_load(&e->size): 0;
+        if (adapted != 0) {
+            if (adapted < size) size = adapted;
+            *seed = *seed * 1103515245 + 12345;
+            *track = (*seed >> 16) % CO_STACK_SAMPLING == 0;
+        }
+    }
+    return size;
+}
 
-static co_array_t *co_array_create() {
-    co_array_t *array = (co_array_t *)malloc(sizeof(co_array_t));
-    array->len = 0, array->cap = 1;
-    array->data =
-        (co_array_value_t *)malloc(sizeof(co_array_value_t) * array->cap);
-    return array;
+// make the resident pages of a stack taken for a routine to be measured 
+// hold the canary
+static void co_stack_clean(void *stack, size_t size) {
+    // dropped pages aren't resident any more, just like those of a fresh one
+    if (co_stack_link(stack, size)->dirty) madvise(stack, size, MADV_DONTNEED);
 }
-static void co_array_destroy(co_array_t *arr) { 
-    for (int i = 0; i < arr->len; ++i) free(arr->data[i]);
-    free(arr->data), free(arr); 
+
+int co_set_stack_mode(int mode) {
+    if (mode < CO_STACK_FIXED || mode > CO_STACK_ADAPT) return -1;
+    _co_stack_mode = mode;
+    return 0;
 }
-static void co_array_add(co_array_t *arr, co_array_value_t value) {
-    if (arr->len == arr->cap) {
-        arr->cap <<= 1;
-        co_array_value_t *new =
-            (co_array_value_t *)malloc(sizeof(co_array_value_t) * arr->cap);
-        for (int i = 0; i < arr->len; ++i)
-            new[i] = arr->data[i];
-        free(arr->data);
-        arr->data = new;
+
+int co_stack_stats(co_stack_stats_t *stats, int n) {
+    int count = 0;
+    for (int i = 0; i < CO_STACK_ENTRIES; ++i) {
+        co_stack_entry_t *e = &_co_stack_entries[i];
+        long long marks = atomic_load(&e->count);
+        if (atomic_load(&e->entry) == NULL || marks == 0) continue;
+        if (count < n) {
+            co_stack_stats_t *stat = &stats[count];
+            stat->entry = atomic_load(&e->entry);
+            stat->count = marks;
+            stat->max = atomic_load(&e->max);
+            stat->avg = atomic_load(&e->total) / marks;
+            stat->size = atomic_load(&e->size);
+        }
+        ++count;
     }
-    arr->data[arr->len++] = value;
+    return count;
 }
-#define co_array_set(_arr, _idx, _val) (_arr->data[_idx])
-#define co_array_get(_arr, _idx, _typ) ((_typ) _arr->data[_idx])
 
 /* Implementation of Corotine  */
 
 typedef struct co_meta_t co_meta_t;
 typedef struct co_struct_t co_struct_t;
+typedef struct co_queue_t co_queue_t;
+typedef struct co_pool_t co_pool_t;
+typedef struct co_waiter_t co_waiter_t;
+typedef struct co_timer_t co_timer_t;
+typedef struct co_gen_t co_gen_t;
 typedef struct co_scheduler_t co_scheduler_t;
+typedef struct co_slab_t co_slab_t;
+typedef struct co_group_t co_group_t;
+typedef struct co_prof_ring_t co_prof_ring_t;
 
-// meta information of routines PER THREAD
-struct co_meta_t {
-    pthread_t tid;
-        // thread id
-    co_struct_t *running; 
-        // point to the current running routine (user-created one), 
-        // NULL if main routine is running 
-    ucontext_t main_uc;
-        // ucontext of the main routine
+// a routine parked on some event,
+// linked in the waiter list (or queue) of that event
+struct co_waiter_t {
+    co_struct_t *coro;
+    co_waiter_t *prev;
+    co_waiter_t *next;
+    void *elem;
+        // where a channel copies from (sending) or to (receiving)
+    int ok;
+        // set before it is woken up by a channel, 0 if it has been closed
+    _Atomic int *pending;
+        // for a routine joining several at once (co_wait_all_of), the 
+        // number of them still running, as it is only woken by the last 
+        // one; NULL for every other waiter
+};
+
+static inline void co_waiter_link(co_waiter_t **list, co_waiter_t *waiter) {
+    waiter->prev = NULL;
+    waiter->next = *list;
+    if (*list != NULL) (*list)->prev = waiter;
+    *list = waiter;
+}
+
+static inline void co_waiter_unlink(co_waiter_t **list, co_waiter_t *waiter) {
+    if (waiter->prev != NULL) waiter->prev->next = waiter->next;
+    else *list = waiter->next;
+    if (waiter->next != NULL) waiter->next->prev = waiter->prev;
+}
+
+static inline void co_waitq_push(co_waitq_t *queue, co_waiter_t *waiter) {
+    waiter->next = NULL;
+    if (queue->tail != NULL) queue->tail->next = waiter;
+    else queue->head = waiter;
+    queue->tail = waiter;
+}
+
+static inline co_waiter_t *co_waitq_pop(co_waitq_t *queue) {
+    co_waiter_t *waiter = queue->head;
+    if (waiter != NULL) {
+        queue->head = waiter->next;
+        if (queue->head == NULL) queue->tail = NULL;
+    }
+    return waiter;
+}
+
+// a timer armed by a routine, see the Timers section
+struct co_timer_t {
+    long long deadline;
+        // CLOCK_MONOTONIC time in ns
+    co_struct_t *coro;
+        // routine to wake up
+    co_meta_t *meta;
+    int idx;
+        // the heap it is in and its index there, -1 once it is out
 };
 
-#define STACK_SIZE SIGSTKSZ
+static inline long long _co_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline void co_heap_set(co_timer_t **heap, int idx, co_timer_t *timer) {
+    heap[idx] = timer;
+    timer->idx = idx;
+}
+
+static void co_heap_sift_up(co_timer_t **heap, int idx) {
+    co_timer_t *timer = heap[idx];
+    while (idx > 0 && heap[(idx - 1) / 2]->deadline > timer->deadline) {
+        co_heap_set(heap, idx, heap[(idx - 1) / 2]);
+        idx = (idx - 1) / 2;
+    }
+    co_heap_set(heap, idx, timer);
+}
+
+static void co_heap_sift_down(co_timer_t **heap, int n, int idx) {
+    co_timer_t *timer = heap[idx];
+    for (int child; (child = 2 * idx + 1) < n; idx = child) {
+        if (child + 1 < n && heap[child + 1]->deadline < heap[child]->deadline)
+            child++;
+        if (heap[child]->deadline >= timer->deadline) break;
+        co_heap_set(heap, idx, heap[child]);
+    }
+    co_heap_set(heap, idx, timer);
+}
+
+// take the timer at idx out of a heap of n timers
+static void co_heap_remove(co_timer_t **heap, int n, int idx) {
+    heap[idx]->idx = -1;
+    if (idx == --n) return;
+    co_heap_set(heap, idx, heap[n]);
+    co_heap_sift_up(heap, idx);
+    // heap[n] still points to the moved timer
+    co_heap_sift_down(heap, n, heap[n]->idx);
+}
+
+#define CO_LOCAL_INLINE (4)
+    // coroutine-local values kept in the control block itself
 
-// task structure of a USER-CREATED routine
+// task structure of a routine,
+// the fields touched by every switch come first and share a cache line
 struct co_struct_t {
-    cid_t cid;
+    co_ctx_t ctx;
+        // saved context of this routine
+        // recorded by _co_ctx_swap when it is suspended
+    co_struct_t *next;
+        // intrusive link in the run queue (or wake-up inbox) of its thread,
+        // or in the free list once it is reaped
+    co_meta_t *owner;
+        // meta information of the thread it last ran on
+    _Atomic int on_cpu;
+        // set while its context is in use by some thread, another thread 
+        // resuming it waits until the context is completely saved
+    _Atomic int parked;
+        // set while it is parked waiting for some event, 
+        // whoever clears it has the right to wake it up
+    _Atomic int cid;
+        // routine id, see the registry below for its layout;
+        // negative once the routine is reaped
+    co_spin_t wait_lock;
+    co_waiter_t *waiters;
+        // routines parked in co_wait/co_getret on this one,
+        // woken once when it finishes
+    char shared;
+        // set if it runs on the shared stack of its thread (copy-stack mode)
+    char lazy;
+        // set while a routine from co_spawn hasn't started yet, it gets 
+        // its stack (unless on the shared stack) when first picked to run
+    char prio;
+    char edf;
+        // priority class (CO_PRIO_*), and whether it has a deadline, 
+        // which puts it ahead of all classes, see _co_ready_put
+    unsigned short nopreempt;
+        // depth of critical sections it is in, library calls included;
+        // it is only preempted at 0, see _co_preempt_handler
+
+    int parent;
+        // cid of the parent routine (user-created one),
+        // -1 if the parent routine is main
+    co_func_t func;
+    int (*func_arg)(void *);
+    void *arg;
+        // entry of this routine, either func() or func_arg(arg)
+    _Atomic int refs;
+    _Atomic int released;
+        // references keeping it from being reaped: one dropped by 
+        // co_release, the other once its stack is released
     pthread_t tid;
-        // routine&thread id
-    co_struct_t *parent;
-        // point to the parent routine (user-created one),
-        // NULL if the parent routine is main
+        // thread id, the thread is the creator one
+    co_pool_t *pool;
+        // the worker pool this routine runs in (M:N mode),
+        // NULL if it is bound to its creator thread
     void *stack;
-        // stack space for this routine
-        // binded by ucontext library functions
-    ucontext_t uc;
-        // uncontext of this routine
-        // recorded by ucontext library functions
-    co_status_t status;
-        // running status of this routine
-        // can either be RUNNING or FINISHED
-    co_ret_t ret;
-        // return val of this routine
-    co_lock_t lock;
-        // a rwlock of this routine
-        // used to control concurrent R/W of ret&status
+    size_t stack_size;
+        // stack space for this routine, taken from the stack pool;
+        // NULL for one on the shared stack, or until a lazy one first runs
+    int track;
+        // set if its stack is measured once released (see Stack Tracking)
+    _Atomic unsigned long long state;
+        // running status (RUNNING or FINISHED) in the high half and 
+        // return value in the low half, published at once by _co_finish;
+        // kept off the cache lines written by every switch, for threads 
+        // polling it
+    co_gen_t *gen;
+        // the generator it runs, NULL for routines started by co_start
+    co_group_t *group;
+        // the task group it is a member of, if any
+    long long nswitch;
+    long long run_ns;
+    long long wait_ns;
+        // times it was switched to, time it ran and time it spent in 
+        // co_wait (or co_getret, co_wait_timeout); only counted while 
+        // the profiler is on, see _co_prof_switch
+    long long deadline;
+    co_timer_t edf_node;
+        // deadline set by co_setdeadline (CLOCK_MONOTONIC ns), and its 
+        // node in the deadline heap of its thread while it is queued there
+    co_waiter_t waiter;
+    co_timer_t timer;
+        // what it is parked on, others reach them while it is suspended,
+        // when the stack of a routine in copy-stack mode isn't in place
+    void *saved;
+    size_t saved_size;
+    size_t saved_cap;
+        // live part of its stack while another routine is on the shared 
+        // stack (copy-stack mode)
+    void *local[CO_LOCAL_INLINE];
+    void **local_spill;
+    int local_cap;
+        // values of coroutine-local keys, the first CO_LOCAL_INLINE ones 
+        // in place and the others in local_spill (local_cap of them); 
+        // all NULL again once it has finished
+} __attribute__((aligned(64)));
+
+#ifdef CO_CTX_ASM
+_Static_assert(offsetof(co_struct_t, parent) <= 64, 
+    "hot fields of co_struct_t should share a cache line");
+#endif
+
+#define CO_STATE_STATUS(state) ((co_status_t) ((state) >> 32))
+#define CO_STATE_RET(state) ((co_ret_t) (unsigned int) (state))
+
+// a release store pairs with the acquire loads of readers, on any thread,
+// which thus see everything the routine did before finishing
+static inline void _co_state_set(co_struct_t *coro, co_status_t status, 
+                                 co_ret_t ret) {
+    unsigned long long state = (unsigned long long) (unsigned int) status << 32
+                               | (unsigned int) ret;
+    atomic_store_explicit(&coro->state, state, memory_order_release);
+}
+
+static inline co_status_t _co_status(co_struct_t *coro) {
+    return CO_STATE_STATUS(
+        atomic_load_explicit(&coro->state, memory_order_acquire));
+}
+
+// the function a routine was started at, which identifies its kind
+static inline void *_co_entry(co_struct_t *coro) {
+    return coro->func != NULL? (void *) coro->func: (void *) coro->func_arg;
+}
+
+// intrusive FIFO of runnable routines
+struct co_queue_t {
+    co_struct_t *head;
+    co_struct_t *tail;
+};
+
+static inline void co_queue_push(co_queue_t *queue, co_struct_t *coro) {
+    coro->next = NULL;
+    if (queue->tail != NULL) queue->tail->next = coro;
+    else queue->head = coro;
+    queue->tail = coro;
+}
+
+static inline void co_queue_push_front(co_queue_t *queue, co_struct_t *coro) {
+    coro->next = queue->head;
+    if (queue->head == NULL) queue->tail = coro;
+    queue->head = coro;
+}
+
+static inline co_struct_t *co_queue_pop(co_queue_t *queue) {
+    co_struct_t *coro = queue->head;
+    if (coro != NULL) {
+        queue->head = coro->next;
+        if (queue->head == NULL) queue->tail = NULL;
+    }
+    return coro;
+}
+
+// Runnable routines fall in classes, served highest first: routines with
+// a deadline (earliest first), then one class per priority. A class that 
+// is passed over CO_AGING_LIMIT times in a row while holding routines 
+// gets the next pick, thus lower classes are slowed down but never starve.
+#define CO_CLASS_EDF (0)
+#define CO_CLASSES (CO_PRIO_LOW + 3)
+#define CO_AGING_LIMIT (8)
+
+#define CO_CLASS_NORMAL (CO_PRIO_NORMAL - CO_PRIO_HIGH + 1)
+
+static inline int co_class_of(co_struct_t *coro) {
+    return coro->prio - CO_PRIO_HIGH + 1;
+}
+
+// where the suspended routine goes on a switch
+#define REQUEUE_NONE (0)
+#define REQUEUE_BACK (1)
+#define REQUEUE_FRONT (2)
+
+// meta information of routines PER THREAD,
+// kept in thread-local storage (see _co_getmeta)
+struct co_meta_t {
+    co_struct_t *running; 
+        // point to the current running routine,
+        // &main if main routine is running 
+    co_struct_t main;
+        // pseudo routine standing for the main routine of this thread, 
+        // so that it can be queued just like user-created ones;
+        // for a pool worker, it is the scheduling loop and never queued
+    co_queue_t ready[CO_CLASSES];
+    co_timer_t **edf;
+    int nedf;
+    int edf_cap;
+    unsigned int ready_mask;
+    int skipped[CO_CLASSES];
+    co_spin_t ready_lock;
+        // runnable routines of this thread, excluding the running one: 
+        // a min-heap of those with deadlines, a FIFO per priority class 
+        // (ready[CO_CLASS_EDF] is unused), a bit per non-empty class but 
+        // the normal one, and how many picks each class has been passed 
+        // over (see _co_ready_take); the lock is only taken in M:N mode, 
+        // where others steal from it
+    _Atomic(co_struct_t *) inbox;
+        // routines of this thread woken up by other threads,
+        // a lock-free stack moved into ready by the thread itself
+    co_struct_t *prev;
+        // routine suspended by the last switch
+    co_struct_t *requeue;
+    int requeue_how;
+        // routine suspended by the last switch, queued by the resumed 
+        // one only after its context is completely saved, otherwise 
+        // another worker could steal and resume it half-saved
+    co_struct_t *zombie;
+        // a routine that has just finished, its stack can't be 
+        // released while running on it, thus the next resumed 
+        // routine releases it 
+    co_stack_pool_t stacks;
+        // cached free stacks of this thread
+    co_pool_t *pool;
+    unsigned int seed;
+        // the worker pool this thread belongs to (M:N mode) and 
+        // its random seed for picking victims to steal from
+    long long switches;
+        // number of context switches made by this thread
+    co_queue_t reaped;
+    int nreaped;
+        // reaped routines whose slots and memory can be reused 
+        // by this thread, in FIFO order
+    co_struct_t *spare;
+        // reaped routines taken over from other threads as a whole, 
+        // already aged and reused right away without walking the list
+    co_struct_t *slab_next;
+    int slab_left;
+        // fresh control blocks left in the last slab of this thread
+    unsigned int stack_seed;
+        // picks the routines measured in CO_STACK_ADAPT mode
+    int epfd;
+        // epoll instance of this thread, -1 until it waits on an fd
+    unsigned int epoll_gen;
+        // tags fds registered into epfd, unlike the fd number never reused
+    int evfd;
+        // eventfd in epfd that wakes the thread up from epoll_wait
+    _Atomic int idle;
+        // how the thread blocks in _co_idle, CO_IDLE_RUNNING otherwise
+    _Atomic int nio;
+        // number of routines parked on fds polled by this thread
+    co_timer_t **timers;
+    _Atomic int ntimers;
+    int timers_cap;
+    co_spin_t timer_lock;
+        // min-heap of pending timers armed by routines on this thread;
+        // the lock is there for routines resumed elsewhere cancelling them
+    void *shared_stack;
+    size_t shared_size;
+        // stack of the routines started in copy-stack mode on this thread,
+        // NULL until the first of them
+    co_struct_t *shared_owner;
+        // the routine whose frames are on the shared stack, NULL if none
+    co_ctx_t copier;
+    void *copier_stack;
+    co_struct_t *copy_to;
+        // context on a small stack of its own that swaps frames on and off
+        // the shared stack, and the routine it then switches to
+    timer_t preempt_timer;
+    int preempt_armed;
+        // CPU-time timer ticking every time slice of this thread, 
+        // created by the first co_set_preempt on it
+    long long preempt_mark;
+    int preempt_pending;
+        // switch count seen by the last tick, and whether a tick found 
+        // the running routine overdue but couldn't preempt it
+    co_prof_ring_t *prof_ring;
+        // samples taken on this thread, NULL until its first one
+    long long prof_since;
+    unsigned int prof_epoch;
+        // when the running routine was switched to, valid if prof_epoch 
+        // is that of the current profiler run
 };
 
+// a chunk of fresh control blocks, see _co_slab_refill
+struct co_slab_t {
+    co_slab_t *next;
+    size_t size;
+        // bytes mapped, this header included
+} __attribute__((aligned(64)));
+
 // scheduler of all coroutines
 struct co_scheduler_t {
-    co_array_t *tinfo;
-    co_lock_t tinfo_lock;
-        // list of thread meta information and its rwlock
-    co_array_t *cinfo;
-    co_lock_t cinfo_lock;
-        // list of routine information and its rwlock
+    co_registry_t cinfo;
+        // list of routine information, indexed by the slot part of cids
+    _Atomic(co_struct_t *) reaped;
+        // reaped routines handed over by threads with too many of them
+        // cached, a lock-free stack only ever popped as a whole
+    pthread_key_t meta_key;
+        // releases the thread meta information at thread exit
+    _Atomic int live;
+        // number of unfinished user-created routines
+    co_waiter_t *idle_waiters;
+    co_spin_t idle_lock;
+        // routines parked in co_waitall until live drops to zero
+    _Atomic int nidle;
+        // number of routines inside co_waitall, so that finishing
+        // routines only take idle_lock when someone is waiting
+    co_registry_t fds;
+        // wait state of file descriptors, indexed by fd
+    _Atomic unsigned int epoll_gen;
+        // number of epoll instances ever created by threads
+    _Atomic(co_slab_t *) slabs;
+        // memory of all control blocks, only freed with the scheduler
 };
 
-static co_lock_t _co_scheduler_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_once_t _co_scheduler_once = PTHREAD_ONCE_INIT;
 static co_scheduler_t *_co_scheduler;
 
-#define _tinfo _co_scheduler->tinfo
-#define _tinfo_lock _co_scheduler->tinfo_lock
-#define _cinfo _co_scheduler->cinfo 
-#define _cinfo_lock _co_scheduler->cinfo_lock 
+// meta information of the current thread,
+// NULL until the thread first touches the library
+static __thread co_meta_t *_co_self;
+
+#define _cinfo (&_co_scheduler->cinfo)
 #define _thread_id pthread_self()
 
-void co_scheduler_init() {
-    RDLOCK(&_co_scheduler_lock);
-    if (_co_scheduler == NULL) {
-        UNLOCK(&_co_scheduler_lock);
-        WRLOCK(&_co_scheduler_lock);
-        if (_co_scheduler == NULL) {
-            _co_scheduler = (co_scheduler_t *) malloc(sizeof(co_scheduler_t));
-            INITLOCK(&_tinfo_lock, NULL);
-            INITLOCK(&_cinfo_lock, NULL);
-            _tinfo = co_array_create();
-            _cinfo = co_array_create();
-        }
+// A cid consists of a slot in _cinfo (low CO_SLOT_BITS bits) and the 
+// generation of that slot. Once a finished routine is released by 
+// co_release, its slot and control block are reused for a later routine 
+// under the next generation, so that memory is bounded by the number of 
+// routines alive rather than ever created, and stale cids are detected.
+// Control blocks are never freed, a racing lookup always reads a valid one.
+// A thread only reuses its reaped blocks once it has cached at least 
+// CO_REUSE_DELAY of them, so that a slot goes through generations slowly.
+// Slots are limited to MAXN rather than taken from the generation bits, 
+// a co_start finding none left fails instead.
+#define CO_SLOT_BITS (20)
+#define CO_SLOT_MASK ((1 << CO_SLOT_BITS) - 1)
+#define CO_GEN_MASK ((1 << (31 - CO_SLOT_BITS)) - 1)
+#define CO_REAPED (INT_MIN)
+#define CO_REUSE_DELAY (64)
+#define CO_REAPED_CACHE_MAX (1024)
+
+_Static_assert((1 << CO_SLOT_BITS) == MAXN, "MAXN is the number of slots");
+_Static_assert(REGISTRY_CAP >= MAXN, "registry too small for MAXN slots");
+
+// hand the reaped blocks cached by a thread over to others
+static void _co_reaped_flush(co_meta_t *meta) {
+    if (meta->reaped.head == NULL) return;
+    co_struct_t *head = atomic_load(&_co_scheduler->reaped);
+    do meta->reaped.tail->next = head;
+    while (!atomic_compare_exchange_weak(&_co_scheduler->reaped, 
+                                         &head, meta->reaped.head));
+    meta->reaped.head = meta->reaped.tail = NULL;
+    meta->nreaped = 0;
+}
+
+static void _co_prof_detach(co_meta_t *meta);
+static void _co_local_clear(co_struct_t *coro);
+
+static void _co_meta_destroy(void *ptr) {
+    co_meta_t *meta = (co_meta_t *) ptr;
+    // values of the main routine go with its thread, 
+    // their destructors may still use the library
+    _co_local_clear(&meta->main);
+    // a profiler tick on the way out must not find it
+    _co_self = NULL;
+    atomic_signal_fence(memory_order_seq_cst);
+    _co_prof_detach(meta);
+    if (meta->preempt_armed) timer_delete(meta->preempt_timer);
+    if (meta->shared_stack != NULL) {
+        co_stack_free(&meta->stacks, meta->shared_stack, meta->shared_size, 1);
+        co_stack_free(&meta->stacks, meta->copier_stack, CO_COPIER_STACK, 1);
+    }
+    co_stack_pool_destroy(&meta->stacks);
+    for (co_struct_t *next; meta->spare != NULL; meta->spare = next) {
+        next = meta->spare->next;
+        co_queue_push(&meta->reaped, meta->spare);
     }
-    UNLOCK(&_co_scheduler_lock);
+    _co_reaped_flush(meta);
+    if (meta->epfd >= 0) close(meta->epfd);
+    if (meta->evfd >= 0) close(meta->evfd);
+    free(meta->timers);
+    free(meta->edf);
+    free(meta);
+}
+
+static void _co_scheduler_create() {
+    _co_scheduler = (co_scheduler_t *) calloc(1, sizeof(co_scheduler_t));
+    _co_page_size = sysconf(_SC_PAGESIZE);
+    pthread_key_create(&_co_scheduler->meta_key, _co_meta_destroy);
+}
+
+void co_scheduler_init() {
+    pthread_once(&_co_scheduler_once, _co_scheduler_create);
 }
 
 void co_scheduler_destroy() {
-    RDLOCK(&_co_scheduler_lock);
     if (_co_scheduler != NULL) {
-        UNLOCK(&_co_scheduler_lock);
-        WRLOCK(&_co_scheduler_lock);
-        if (_co_scheduler != NULL) {
-            WRLOCK(&_tinfo_lock);
-            WRLOCK(&_cinfo_lock);
-            co_array_destroy(_tinfo);
-            co_array_destroy(_cinfo);
-            UNLOCK(&_tinfo_lock);
-            UNLOCK(&_cinfo_lock);
-            free(_co_scheduler);
+        co_registry_destroy(_cinfo, 0);
+        co_registry_destroy(&_co_scheduler->fds, 1);
+        for (co_slab_t *next; _co_scheduler->slabs != NULL; 
+             _co_scheduler->slabs = next) {
+            next = _co_scheduler->slabs->next;
+            munmap(_co_scheduler->slabs, _co_scheduler->slabs->size);
         }
+        co_stack_chunks_destroy();
+        pthread_key_delete(_co_scheduler->meta_key);
+        free(_co_scheduler);
+        _co_scheduler = NULL;
     }
-    UNLOCK(&_co_scheduler_lock);
 }
 
-static co_meta_t* _co_getmeta() {
-    co_meta_t *ret = NULL;
-    for (int i = 0; i < _tinfo->len; ++i) {
-        co_meta_t *cur = co_array_get(_tinfo, i, co_meta_t*);
-        // tid won't change, thus no lock is needed
-        if (pthread_equal(cur->tid, _thread_id)) {
-            ret = cur; break;
-        }
-    }
-    return ret;
+// slow path of _co_getmeta, taken once per thread
+static co_meta_t* _co_meta_create() {
+    co_scheduler_init();
+    // main is a control block, aligned like any other
+    co_meta_t *meta = (co_meta_t*) aligned_alloc(_Alignof(co_meta_t), 
+                                                 sizeof(co_meta_t));
+    memset(meta, 0, sizeof(co_meta_t));
+    meta->main.cid = -1;
+    meta->main.tid = _thread_id;
+    _co_state_set(&meta->main, RUNNING, -1);
+    meta->main.owner = meta;
+    meta->main.on_cpu = 1;
+    meta->running = &meta->main;
+    meta->epfd = -1;
+    meta->evfd = -1;
+    // the key is only used for its destructor,
+    // lookups go through _co_self directly
+    pthread_setspecific(_co_scheduler->meta_key, meta);
+    return _co_self = meta;
 }
 
-int co_getid() {
-    co_struct_t *coro = _co_getmeta()->running;
-    return coro != NULL? coro->cid: -1;
+// meta information of the current thread, created on first use;
+// costs a single TLS load no matter how many threads are running
+static inline co_meta_t* _co_getmeta() {
+    co_meta_t *meta = _co_self;
+    if (__builtin_expect(meta == NULL, 0)) meta = _co_meta_create();
+    return meta;
 }
 
-// a wrapper is needed to record the return values of routines 
-static void _co_func_wrapper(co_struct_t *coro, co_func_t func) {
-    co_ret_t ret = func();
-// printf("[dbg] finish cid %d\n", coro->cid);
+// in M:N mode a routine may be resumed on another thread than the one 
+// it was suspended on, and compilers are free to keep the address of a 
+// TLS variable across a call, thus after a switch the meta information 
+// is always reloaded through this non-inlined function
+static __attribute__((noinline)) co_meta_t *_co_curmeta() {
+    return _co_self;
+}
 
-    // it is here where routines are actually finished
-    WRLOCK(&coro->lock);
-    coro->status = FINISHED;
-    coro->ret = ret;
-    co_meta_t *meta = _co_getmeta();
-    assert(meta != NULL);
-    meta->running = coro->parent;
-    free(coro->stack);
-// printf("[dbg] give back to %p\n", coro->parent);
-    UNLOCK(&coro->lock);
+// Library code runs with preemption off: a public function touching the 
+// scheduler state counts the calling routine as in a critical section 
+// from the start of CO_NOPREEMPT till it returns (see Preemption)
+static inline co_struct_t *_co_preempt_off(co_meta_t *meta) {
+    co_struct_t *self = meta->running;
+    self->nopreempt++;
+    atomic_signal_fence(memory_order_seq_cst);
+    return self;
 }
 
-int co_start(co_func_t routine) {
-    // check if scheduler is initialized
-    co_scheduler_init();
+static inline void _co_preempt_on(co_struct_t **self) {
+    atomic_signal_fence(memory_order_seq_cst);
+    (*self)->nopreempt--;
+}
 
-    // create a new corotine structure
-    co_struct_t *new_struct = (co_struct_t *)malloc(sizeof(co_struct_t));
+#define CO_NOPREEMPT(meta) \
+    co_struct_t *_co_nopreempt __attribute__((cleanup(_co_preempt_on))) = \
+        _co_preempt_off(meta)
 
-    WRLOCK(&_cinfo_lock);
-    WRLOCK(&_tinfo_lock);
+static void _co_pool_notify(co_pool_t *pool);
+static int _co_materialize(co_meta_t *meta, co_struct_t *coro);
+static int _co_shared_prepare(co_meta_t *meta);
+static int _co_netpoll(co_meta_t *meta, int timeout);
+static void _co_timers_fire(co_meta_t *meta);
+static void _co_idle(co_meta_t *meta);
+static int _co_idle_wake(co_meta_t *meta);
+static int _co_worker_pending(co_meta_t *meta);
 
-    new_struct->tid = _thread_id;
-    new_struct->status = RUNNING;
-    new_struct->ret = -1;
-    INITLOCK(&new_struct->lock, NULL);
+static _Atomic int _co_prof_on;
+static _Atomic unsigned int _co_prof_epoch;
+    // whether the profiler is on, and how many times it has been started
+static void _co_prof_switch(co_meta_t *meta, co_struct_t *prev, 
+                            co_struct_t *next);
 
-    new_struct->cid = _cinfo->len;
-    co_array_add(_cinfo, new_struct);
-// printf("[dbg] start cid %d\n", new_struct->cid);
+// time for the per-routine counters, 0 if the profiler is off
+static inline long long _co_prof_clock() {
+    return atomic_load_explicit(&_co_prof_on, memory_order_relaxed)? 
+        _co_now(): 0;
+}
 
-    co_meta_t* meta = _co_getmeta();
-    // if current thread doesn't have its thread meta 
-    // information entry, created one 
-    if (meta == NULL) {
-        co_meta_t *new_meta = (co_meta_t*) malloc(sizeof(co_meta_t));
-        co_array_add(_tinfo, new_meta);
-        new_meta->tid = _thread_id;
-        new_meta->running = NULL;
-        meta = new_meta;
-// printf("[dbg] main, ucontex %p\n", &meta->main_uc);
-    }
-
-    UNLOCK(&_cinfo_lock);
-    UNLOCK(&_tinfo_lock);
-
-    new_struct->parent = meta->running;
-// printf("[dbg] parent %p\n", new_struct->parent);
-// printf("[dbg] cid %d, ucontext %p\n", new_struct->cid, &new_struct->uc);
-
-    // user-created routine as parent
-    if (meta->running != NULL)
-        new_struct->uc.uc_link = &meta->running->uc;
-    // system-created routine as parent
-    else
-        new_struct->uc.uc_link = &meta->main_uc;
-    meta->running = new_struct;
-
-    // initalize corotine context
-    if (getcontext(&new_struct->uc) < 0) return -1;
-    new_struct->stack = malloc(STACK_SIZE);
-    new_struct->uc.uc_stack.ss_sp = new_struct->stack;
-    new_struct->uc.uc_stack.ss_size = STACK_SIZE;
-    makecontext(&new_struct->uc, 
-        (void (*)(void))_co_func_wrapper, 2, new_struct, routine);
-
-    // save current context in uc_ret,
-    // and start coroutine with context uc_cur
-    if (swapcontext(new_struct->uc.uc_link, &new_struct->uc) < 0) return -1;
+#define CO_NETPOLL_INTERVAL (64)
+    // busy threads poll their fds every this many switches
+#define CO_IDLE_RUNNING (0)
+#define CO_IDLE_FUTEX (1)
+#define CO_IDLE_EPOLL (2)
+    // an idle thread blocks on its idle word, or in epoll_wait 
+    // if it has routines parked on fds
+#define CO_IDLE_SPINS (64)
+    // rounds of yielding the CPU, for a wake-up from another thread or
+    // work to steal, before an idle thread blocks in the kernel
 
-    // return cid
-    return new_struct->cid;
+// queue a routine in the deadline heap, 0 if out of memory
+static __attribute__((noinline)) int _co_edf_put(co_meta_t *meta, 
+                                                 co_struct_t *coro) {
+    if (meta->nedf == meta->edf_cap) {
+        int cap = meta->edf_cap? meta->edf_cap * 2: 16;
+        co_timer_t **heap = (co_timer_t **) 
+            realloc(meta->edf, sizeof(co_timer_t *) * cap);
+        if (heap == NULL) return 0;
+        meta->edf = heap, meta->edf_cap = cap;
+    }
+    coro->edf_node.deadline = coro->deadline;
+    coro->edf_node.coro = coro;
+    meta->edf[meta->nedf] = &coro->edf_node;
+    co_heap_sift_up(meta->edf, meta->nedf++);
+    meta->ready_mask |= 1u << CO_CLASS_EDF;
+    return 1;
 }
 
-int co_yield() {
-    // check if scheduler is initialized
-    co_scheduler_init();
-    
-    RDLOCK(&_tinfo_lock);
-    // get metainfo for the current thread 
-    co_meta_t *meta = _co_getmeta(); 
-    if (meta == NULL) {
-        UNLOCK(&_tinfo_lock);
-        return 0;
+// queue a routine in its class, under ready_lock in M:N mode
+static inline void _co_ready_put(co_meta_t *meta, co_struct_t *coro, 
+                                 int front) {
+    // it keeps its priority class when out of memory
+    if (__builtin_expect(coro->edf, 0) && _co_edf_put(meta, coro)) return;
+    int cls = co_class_of(coro);
+    if (front) co_queue_push_front(&meta->ready[cls], coro);
+    else co_queue_push(&meta->ready[cls], coro);
+    if (__builtin_expect(cls != CO_CLASS_NORMAL, 0)) 
+        meta->ready_mask |= 1u << cls;
+}
+
+// the class to serve when several hold routines: the highest one,
+// unless a lower one has been passed over too many times
+static __attribute__((noinline)) 
+int _co_ready_age(co_meta_t *meta, unsigned int mask) {
+    int top = __builtin_ctz(mask), pick = top;
+    for (int cls = top + 1; cls < CO_CLASSES; ++cls) {
+        if (!(mask & 1u << cls)) continue;
+        if (pick == top && meta->skipped[cls] >= CO_AGING_LIMIT) pick = cls;
+        else meta->skipped[cls]++;
     }
-    UNLOCK(&_tinfo_lock);
-
-    ucontext_t *suspend_ucp, *resume_ucp;
-
-    int lower_bound;
-    // to suspend a user-created routine,
-    // search routines with a greater cid
-    if (meta->running != NULL) {
-        lower_bound = meta->running->cid + 1;
-        suspend_ucp = &meta->running->uc;
-    }
-    // to suspend a system-created routine,
-    // search all routines
-    else {
-        lower_bound = 0;
-        suspend_ucp = &meta->main_uc;
-    }
-
-    RDLOCK(&_cinfo_lock);
-    // main routine as fallback
-    resume_ucp = &meta->main_uc;
-    meta->running = NULL;
-    for (int i = lower_bound; i < _cinfo->len; ++i) {
-        co_struct_t *tmp = co_array_get(_cinfo, i, co_struct_t*);
-        // no lock is needed for read status,
-        // since status can only be modified from in the same thread,
-        // and the current thread is taken up for resume routine searching
-        co_status_t status = tmp->status;
-        if (pthread_equal(tmp->tid, _thread_id) && tmp->status == RUNNING) {
-            // a feasible routine is found, resume it
-            meta->running = tmp;
-            resume_ucp = &tmp->uc;
-            break;
-        }
+    meta->skipped[pick] = 0;
+    return pick;
+}
+
+// with self (the running routine, or NULL) competing as if it were queued
+// behind the others of its class; NULL when self should go on
+static __attribute__((noinline)) 
+co_struct_t *_co_ready_take_classes(co_meta_t *meta, unsigned int mask, 
+                                    co_struct_t *self) {
+    if (meta->ready[CO_CLASS_NORMAL].head != NULL) 
+        mask |= 1u << CO_CLASS_NORMAL;
+    int own = -1;
+    if (self != NULL) {
+        own = self->edf? CO_CLASS_EDF: co_class_of(self);
+        mask |= 1u << own;
     }
-    UNLOCK(&_cinfo_lock);
+    int cls = (mask & (mask - 1)) == 0? __builtin_ctz(mask): 
+              _co_ready_age(meta, mask);
+    if (cls == own && (cls == CO_CLASS_EDF? 
+            meta->nedf == 0 || meta->edf[0]->deadline > self->deadline: 
+            meta->ready[cls].head == NULL)) return NULL;
+    co_struct_t *coro;
+    if (cls == CO_CLASS_EDF) {
+        coro = meta->edf[0]->coro;
+        co_heap_remove(meta->edf, meta->nedf--, 0);
+        if (meta->nedf == 0) meta->ready_mask &= ~(1u << cls);
+    } else {
+        coro = co_queue_pop(&meta->ready[cls]);
+        if (meta->ready[cls].head == NULL && cls != CO_CLASS_NORMAL) 
+            meta->ready_mask &= ~(1u << cls);
+    }
+    return coro;
+}
 
-// printf("[dbg] swtich from %p to %p\n", suspend_ucp, resume_ucp);
+// dequeue the next routine to run, under ready_lock in M:N mode;
+// as long as every routine is of normal priority, it is a plain FIFO
+static inline co_struct_t *_co_ready_take(co_meta_t *meta) {
+    unsigned int mask = meta->ready_mask;
+    if (__builtin_expect(mask == 0, 1)) 
+        return co_queue_pop(&meta->ready[CO_CLASS_NORMAL]);
+    return _co_ready_take_classes(meta, mask, NULL);
+}
 
-    // only swap context if we're actually swtich to a 
-    // different routine (when yielding from main to main, 
-    // no swtich is needed)
-    if (suspend_ucp != resume_ucp) {
-        if (swapcontext(suspend_ucp, resume_ucp) < 0) return -1;
+static inline void _co_ready_push(co_meta_t *meta, co_struct_t *coro, 
+                                  int front) {
+    if (meta->pool != NULL) co_spin_lock(&meta->ready_lock);
+    _co_ready_put(meta, coro, front);
+    if (meta->pool != NULL) {
+        co_spin_unlock(&meta->ready_lock);
+        _co_pool_notify(meta->pool);
     }
-    return 0;
 }
 
-int co_getret(int cid) {
-    // check if scheduler is initialized
-    co_scheduler_init();
+static inline co_struct_t *_co_ready_pop(co_meta_t *meta) {
+    if (meta->pool == NULL) return _co_ready_take(meta);
+    // peek without the lock first, to keep idle polling cheap
+    if (__atomic_load_n(&meta->ready_mask, __ATOMIC_RELAXED) == 0 &&
+        __atomic_load_n(&meta->ready[CO_CLASS_NORMAL].head, __ATOMIC_RELAXED) 
+            == NULL) return NULL;
+    co_spin_lock(&meta->ready_lock);
+    co_struct_t *coro = _co_ready_take(meta);
+    co_spin_unlock(&meta->ready_lock);
+    return coro;
+}
+
+// Fresh control blocks are carved out of slabs of at least CO_SLAB_MIN 
+// of them, mmap'd and pre-faulted at once, as faulting them in one by one
+// costs more than everything else in creating a routine. A batch creation
+// gets a slab fitting the whole batch; from CO_SLAB_HUGE bytes on it asks
+// for huge pages first, zeroing them costing the same but faulting them 
+// in far less (left to the first touch on kernels without 
+// MADV_POPULATE_WRITE).
+#define CO_SLAB_MIN (64)
+#define CO_SLAB_HUGE (4 << 20)
 
-    RDLOCK(&_cinfo_lock);
-    co_struct_t *qcoro = co_array_get(_cinfo, cid, co_struct_t*);
-    UNLOCK(&_cinfo_lock);
-    
-    while(1) { 
-        RDLOCK(&qcoro->lock);
-        co_status_t status = qcoro->status;
-        co_ret_t ret = qcoro->ret;
-        UNLOCK(&qcoro->lock);
-        if (status == FINISHED) return ret;
-        else co_yield();
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE (23)
+#endif
+
+static int _co_slab_refill(co_meta_t *meta, int want) {
+    int n = want < CO_SLAB_MIN? CO_SLAB_MIN: want;
+    size_t size = sizeof(co_slab_t) + sizeof(co_struct_t) * n;
+    int huge = size >= CO_SLAB_HUGE;
+    co_slab_t *slab = (co_slab_t *) mmap(NULL, size, PROT_READ | PROT_WRITE, 
+        MAP_PRIVATE | MAP_ANONYMOUS | (huge? 0: MAP_POPULATE), -1, 0);
+    if (slab == MAP_FAILED) return -1;
+    if (huge) {
+        madvise(slab, size, MADV_HUGEPAGE);
+        madvise(slab, size, MADV_POPULATE_WRITE);
     }
+    slab->size = size;
+    slab->next = atomic_load(&_co_scheduler->slabs);
+    while (!atomic_compare_exchange_weak(&_co_scheduler->slabs, 
+                                         &slab->next, slab));
+    meta->slab_next = (co_struct_t *) (slab + 1);
+    meta->slab_left = n;
     return 0;
 }
 
-// get UNAUTHORIZED when:
-// 1. invalid cid is provided
-// 2. two routines aren't in the same thread
-// 3. current routine isn't a PARENT or ANCESTOR of queried routine
-int co_status(int cid) {
-    // check if scheduler is initialized
-    co_scheduler_init();
+// give a control block back for reuse once neither the user 
+// nor the scheduler refers to it
+static void _co_unref(co_struct_t *coro) {
+    if (atomic_fetch_sub(&coro->refs, 1) != 1) return;
+    atomic_fetch_or(&coro->cid, CO_REAPED);
+    co_meta_t *meta = _co_curmeta();
+    co_queue_push(&meta->reaped, coro);
+    if (++meta->nreaped > CO_REAPED_CACHE_MAX) _co_reaped_flush(meta);
+}
 
-    RDLOCK(&_tinfo_lock);
-    co_meta_t *meta = _co_getmeta();
-    UNLOCK(&_tinfo_lock);
+// cid of the next life of a reaped control block, one generation on; 
+// a fresh one is stored as reaped from the generation before 0
+static inline int _co_next_cid(co_struct_t *coro) {
+    int gen = ((coro->cid & ~CO_REAPED) >> CO_SLOT_BITS) + 1;
+    return ((gen & CO_GEN_MASK) << CO_SLOT_BITS) | 
+           (coro->cid & CO_SLOT_MASK);
+}
+
+// fresh control blocks reserved at once, the registry slots following 
+// each other like the blocks do
+typedef struct {
+    co_struct_t *next;
+    int slot;
+    int left;
+} co_run_t;
+
+// reserve up to n fresh control blocks as a run (fewer at the end of 
+// a slab), returns how many, 0 once out of slots
+static int _co_run_reserve(co_meta_t *meta, co_run_t *run, int n) {
+    if (meta->slab_left == 0 && _co_slab_refill(meta, n) < 0) return 0;
+    int len = n < meta->slab_left? n: meta->slab_left;
+    int slot = co_registry_reserve(_cinfo, &len, MAXN);
+    if (slot < 0) return 0;
+    run->next = meta->slab_next;
+    run->slot = slot;
+    run->left = len;
+    meta->slab_next += len, meta->slab_left -= len;
+    return len;
+}
+
+// the next block of a run, published in its slot as reaped from the 
+// generation before 0, see _co_next_cid
+static inline co_struct_t *_co_run_take(co_run_t *run) {
+    co_struct_t *coro = run->next++;
+    coro->cid = CO_REAPED | (CO_GEN_MASK << CO_SLOT_BITS) | run->slot;
+    co_registry_put(_cinfo, run->slot++, coro);
+    run->left--;
+    return coro;
+}
 
-    RDLOCK(&_cinfo_lock);
-    if (cid < 0 || cid > _cinfo->len) {
-        UNLOCK(&_cinfo_lock); return UNAUTHORIZED;
+// a control block for a new routine, its cid being that of its last life 
+// (see _co_next_cid): a reaped one if possible, the next one of run 
+// otherwise, which is reserved for want blocks once empty
+static co_struct_t *_co_alloc(co_meta_t *meta, co_run_t *run, int want) {
+    co_struct_t *coro = NULL;
+    if (run->left == 0) {
+        if (meta->nreaped < CO_REUSE_DELAY && meta->spare == NULL &&
+            atomic_load_explicit(&_co_scheduler->reaped, 
+                                 memory_order_relaxed)) {
+            // popping all at once is immune to ABA
+            meta->spare = atomic_exchange(&_co_scheduler->reaped, NULL);
+        }
+        if (meta->nreaped < CO_REUSE_DELAY && meta->spare != NULL) {
+            coro = meta->spare;
+            meta->spare = coro->next;
+            // reaped blocks have long left the cache, and the list is 
+            // walked one block per creation: fetch the next while this 
+            // one is set up
+            if (meta->spare != NULL) __builtin_prefetch(meta->spare, 1);
+        } else if ((meta->nreaped >= CO_REUSE_DELAY || 
+                    _co_run_reserve(meta, run, want) == 0) && 
+                   meta->nreaped > 0) {
+            // aged enough, or out of fresh slots: reuse at once
+            coro = co_queue_pop(&meta->reaped);
+            meta->nreaped--;
+            if (meta->reaped.head != NULL) 
+                __builtin_prefetch(meta->reaped.head, 1);
+        }
     }
-    co_struct_t *qcoro = co_array_get(_cinfo, cid, co_struct_t*);
-    UNLOCK(&_cinfo_lock);
+    if (coro == NULL && run->left > 0) coro = _co_run_take(run);
+    return coro;
+}
 
-    if (pthread_equal(qcoro->tid, _thread_id) && meta != NULL) {
-        if (meta->running == NULL) return qcoro->status;
-        co_struct_t *coro = qcoro;
-        for (; coro != NULL; coro = coro->parent) {
-            if (coro == meta->running) return qcoro->status;
+// finishes a switch on behalf of the previous routine,
+// run by whichever routine is resumed (or started)
+static inline void _co_after_switch(co_meta_t *meta) {
+    atomic_store_explicit(&meta->prev->on_cpu, 0, memory_order_release);
+    if (meta->requeue != NULL) {
+        _co_ready_push(meta, meta->requeue, meta->requeue_how == REQUEUE_FRONT);
+        meta->requeue = NULL;
+    }
+    co_struct_t *zombie = meta->zombie;
+    if (zombie != NULL) {
+        if (zombie->stack != NULL) {
+            if (__builtin_expect(zombie->track, 0)) co_stack_track(
+                _co_entry(zombie), zombie->stack, zombie->stack_size);
+            co_stack_free(&meta->stacks, zombie->stack, zombie->stack_size, 
+                          !zombie->track);
         }
+        zombie->stack = NULL;
+        meta->zombie = NULL;
+        _co_unref(zombie);
     }
-    return UNAUTHORIZED;
 }
 
-int co_wait(int cid) {
-    // check if scheduler is initialized
-    co_scheduler_init();
-    
-    RDLOCK(&_tinfo_lock);
-    co_meta_t *meta = _co_getmeta();
-    UNLOCK(&_tinfo_lock);
+// suspend the running routine and resume coro, the running routine
+// is queued afterwards as requested by how (REQUEUE_*);
+// returns the meta information of the thread it is resumed on;
+// always inlined, every return after the stack swap is mispredicted 
+// (the return stack buffer holds the other context's calls), thus 
+// each extra call level costs a misprediction per switch
+static inline __attribute__((always_inline)) 
+co_meta_t *_co_switch(co_meta_t *meta, co_struct_t *coro, int how) {
+    co_struct_t *prev = meta->running;
+    if (prev == coro) return meta;
+    // the scheduling loop of a pool worker is never queued
+    if (how != REQUEUE_NONE && !(meta->pool != NULL && prev == &meta->main)) {
+        meta->requeue = prev;
+        meta->requeue_how = how;
+    }
+    // a routine woken by another thread may still be switching out there
+    int spins = 0;
+    while (atomic_load_explicit(&coro->on_cpu, memory_order_acquire))
+        co_spin_relax(&spins);
+    atomic_store_explicit(&coro->on_cpu, 1, memory_order_relaxed);
+    coro->owner = meta;
+    meta->prev = prev;
+    meta->running = coro;
+    meta->switches++;
+    if (__builtin_expect(
+            atomic_load_explicit(&_co_prof_on, memory_order_relaxed), 0))
+        _co_prof_switch(meta, prev, coro);
+    co_ctx_t *to = &coro->ctx;
+#ifdef CO_CTX_ASM
+    // the frames of a routine on the shared stack may have to be put back
+    if (__builtin_expect(coro->shared, 0) && meta->shared_owner != coro) {
+        meta->copy_to = coro;
+        to = &meta->copier;
+    }
+#endif
+    _co_ctx_swap(&prev->ctx, to);
+    meta = _co_curmeta();
+    _co_after_switch(meta);
+    return meta;
+}
+
+// take wake-ups from other threads, expired timers and ready fds into 
+// account before picking the next routine
+static inline void _co_poll(co_meta_t *meta) {
+    if (atomic_load_explicit(&meta->ntimers, memory_order_relaxed) > 0) 
+        _co_timers_fire(meta);
+    // routines parked on fds would starve behind busy ones otherwise
+    if (atomic_load_explicit(&meta->nio, memory_order_relaxed) > 0 &&
+        (meta->switches & (CO_NETPOLL_INTERVAL - 1)) == 0) 
+        _co_netpoll(meta, 0);
+    if (atomic_load_explicit(&meta->inbox, memory_order_relaxed) != NULL) {
+        co_struct_t *list = 
+            atomic_exchange_explicit(&meta->inbox, NULL, memory_order_acquire);
+        // the inbox is a stack, reverse it to keep wake-ups in order
+        co_struct_t *reversed = NULL;
+        while (list != NULL) {
+            co_struct_t *next = list->next;
+            list->next = reversed, reversed = list;
+            list = next;
+        }
+        for (; reversed != NULL; reversed = list) {
+            list = reversed->next;
+            _co_ready_push(meta, reversed, 0);
+        }
+    }
+}
 
-    RDLOCK(&_cinfo_lock);
-    co_struct_t *qcoro = co_array_get(_cinfo, cid, co_struct_t*);
-    UNLOCK(&_cinfo_lock);
+// next routine to run on this thread, NULL if nothing is runnable
+static co_struct_t *_co_next(co_meta_t *meta) {
+    _co_poll(meta);
+    co_struct_t *coro;
+    do coro = _co_ready_pop(meta);
+    while (coro != NULL && __builtin_expect(coro->lazy, 0) && 
+           _co_materialize(meta, coro) < 0);
+    return coro;
+}
 
-    while(1) {
-        RDLOCK(&qcoro->lock);
-        co_status_t status = qcoro->status;
-        UNLOCK(&qcoro->lock);
-        if (status == FINISHED) return 0;
-        else co_yield(); 
+// make a parked routine runnable again, from any thread
+static void _co_wake(co_struct_t *coro) {
+    co_meta_t *meta = _co_curmeta();
+    co_meta_t *owner = coro->owner;
+    // in M:N mode any worker of the pool can run it, 
+    // keep it on the current one
+    if (meta == owner || (meta != NULL && meta->pool != NULL && 
+                          meta->pool == coro->pool)) {
+        _co_ready_push(meta, coro, 0);
+        return;
     }
-    return 0;
+    co_struct_t *head = atomic_load_explicit(&owner->inbox, memory_order_relaxed);
+    do coro->next = head;
+    while (!atomic_compare_exchange_weak_explicit(&owner->inbox, &head, coro, 
+        memory_order_release, memory_order_relaxed));
+    // pairs with the owner announcing itself idle before its last look 
+    // at the inbox, either it sees the routine or we see it idle
+    atomic_thread_fence(memory_order_seq_cst);
+    if (owner->pool != NULL) _co_pool_notify(owner->pool);
+    else _co_idle_wake(owner);
 }
 
-int co_waitall() {
-    // check if scheduler is initialized
-    co_scheduler_init();
+// wake a routine up if it is still parked, 
+// returns whether this call is the one that woke it
+static inline int _co_unpark(co_struct_t *coro) {
+    int expected = 1;
+    if (!atomic_compare_exchange_strong(&coro->parked, &expected, 0)) return 0;
+    _co_wake(coro);
+    return 1;
+}
 
-    while (1) {
-        RDLOCK(&_cinfo_lock);
-        int all_finished = 1;
-        for (int i = 0; i < _cinfo->len; ++i) {
-            co_struct_t *tmp = co_array_get(_cinfo, i, co_struct_t*);
-            RDLOCK(&tmp->lock);
-            if (tmp->status != FINISHED) {
-                all_finished = 0;
-                UNLOCK(&tmp->lock);
-                break;
-            }
-            UNLOCK(&tmp->lock);
+// suspend the running routine until someone _co_unparks it;
+// the caller sets running->parked and registers it somewhere beforehand,
+// and it may even be woken up before it is actually suspended
+static co_meta_t *_co_park(co_meta_t *meta) {
+    co_struct_t *next;
+    int spins = 0;
+    while ((next = _co_next(meta)) == NULL) {
+        // a pool worker looks for work in its scheduling loop
+        if (meta->pool != NULL) {
+            next = &meta->main;
+            break;
         }
-        UNLOCK(&_cinfo_lock);
-        if (all_finished) return 0;
-        else co_yield();
+        // nothing on this thread can run until a timer expires, one of 
+        // its fds gets ready or another thread wakes one of its routines
+        if (++spins < CO_IDLE_SPINS) sched_yield();
+        else _co_idle(meta);
     }
-    return 0;
-}
\ No newline at end of file
+    return _co_switch(meta, next, REQUEUE_NONE);
+}
+
+long long co_switch_count() {
+    return _co_getmeta()->switches;
+}
+
+int co_getid() {
+    return _co_getmeta()->running->cid;
+}
+
+static void _co_pool_spawn(co_pool_t *pool, int n);
+
+// wake up routines parked in co_waitall
+static void _co_wake_idle() {
+    co_spin_lock(&_co_scheduler->idle_lock);
+    for (co_waiter_t *waiter = _co_scheduler->idle_waiters, *next; 
+         waiter != NULL; waiter = next) {
+        next = waiter->next;
+        _co_unpark(waiter->coro);
+    }
+    _co_scheduler->idle_waiters = NULL;
+    atomic_store(&_co_scheduler->nidle, 0);
+    co_spin_unlock(&_co_scheduler->idle_lock);
+}
+static void _co_pool_finish(co_pool_t *pool, int n);
+static void _co_group_done(co_group_t *group, int n);
+
+// the status and return value of a finished routine, 
+// for those waiting on it
+static void _co_finish_state(co_struct_t *coro, co_ret_t ret) {
+    co_spin_lock(&coro->wait_lock);
+    _co_state_set(coro, FINISHED, ret);
+    // each waiter is woken exactly once, and no more waiters 
+    // come once the status is FINISHED
+    for (co_waiter_t *waiter = coro->waiters, *next; 
+         waiter != NULL; waiter = next) {
+        next = waiter->next;
+        if (waiter->pending == NULL || atomic_fetch_sub(waiter->pending, 1) == 1)
+            _co_unpark(waiter->coro);
+    }
+    coro->waiters = NULL;
+    co_spin_unlock(&coro->wait_lock);
+}
+
+// count n finished routines of group and pool (either may be NULL)
+static void _co_finish_count(co_group_t *group, co_pool_t *pool, int n) {
+    if (group != NULL) _co_group_done(group, n);
+    if (pool != NULL) _co_pool_finish(pool, n);
+    // pairs with co_waitall: one of the two sees the other's update
+    if (atomic_fetch_sub(&_co_scheduler->live, n) == n &&
+        atomic_load(&_co_scheduler->nidle) > 0) _co_wake_idle();
+}
+
+// it is here where routines are actually finished
+static void _co_finish(co_struct_t *coro, co_ret_t ret) {
+    _co_finish_state(coro, ret);
+    _co_finish_count(coro->group, coro->pool, 1);
+}
+
+// a wrapper is needed to record the return values of routines;
+// inlined, so that routines have one frame under theirs (see Profiler)
+static inline __attribute__((always_inline)) 
+void _co_func_wrapper(co_struct_t *coro) {
+    // it was created in a critical section, to be left for its own code
+    _co_preempt_on(&coro);
+    co_ret_t ret = coro->func != NULL? coro->func(): coro->func_arg(coro->arg);
+    // destructors are user code too, and run before anyone sees it finished
+    _co_local_clear(coro);
+    _co_preempt_off(_co_curmeta());
+// printf("[dbg] finish cid %d\n", coro->cid);
+    _co_finish(coro, ret);
+
+    // give control to the next routine, never to be resumed;
+    // as a parked routine it is never woken up
+    co_meta_t *meta = _co_curmeta();
+    if (coro->shared) {
+        // nothing on the shared stack is worth saving any more
+        if (meta->shared_owner == coro) meta->shared_owner = NULL;
+        free(coro->saved);
+        coro->saved = NULL;
+        coro->saved_size = coro->saved_cap = 0;
+    }
+    meta->zombie = coro;
+    _co_park(meta);
+}
+
+// first function run on the stack of every new routine
+static void _co_func_entry(void) {
+    co_meta_t *meta = _co_curmeta();
+    _co_after_switch(meta);
+    _co_func_wrapper(meta->running);
+}
+
+// the state of a new routine in a control block, but its cid and entry
+static inline void _co_init(co_meta_t *meta, co_struct_t *new_struct, 
+                            void *stack, size_t stack_size, int track, 
+                            int shared) {
+    new_struct->stack = stack;
+    new_struct->stack_size = stack_size;
+    new_struct->track = track;
+    new_struct->tid = _thread_id;
+    new_struct->pool = meta->pool;
+    _co_state_set(new_struct, RUNNING, -1);
+    new_struct->waiters = NULL;
+    new_struct->wait_lock = 0;
+    new_struct->on_cpu = 0;
+    new_struct->parked = 0;
+    new_struct->refs = 2;
+    new_struct->released = 0;
+    new_struct->parent = meta->running->cid;
+    new_struct->func = NULL;
+    new_struct->func_arg = NULL;
+    new_struct->gen = NULL;
+    new_struct->group = NULL;
+    new_struct->nswitch = new_struct->run_ns = new_struct->wait_ns = 0;
+    new_struct->shared = shared;
+    new_struct->lazy = 0;
+    // the priority is inherited, a deadline isn't
+    new_struct->prio = meta->running->prio;
+    new_struct->edf = 0;
+    new_struct->nopreempt = 1;
+    // saved frames are dropped by a finishing routine, and coroutine-local
+    // values cleared, thus reaped blocks have neither
+}
+
+// copy-stack mode is for routines bound to a thread, 
+// pool ones may resume on any worker
+static inline int _co_shared_mode(co_meta_t *meta) {
+    return meta->pool == NULL && _co_shared_stack_size > 0;
+}
+
+// a new routine, not queued nor counted as live yet
+static co_struct_t *_co_create(co_meta_t *meta, int *cid, void *entry) {
+    int shared = _co_shared_mode(meta);
+    int track;
+    size_t stack_size = co_stack_size_for(entry, &meta->stack_seed, &track);
+    void *stack = NULL;
+    if (shared) {
+        if (_co_shared_prepare(meta) < 0) return NULL;
+        stack_size = 0;
+    } else {
+        stack = co_stack_alloc(&meta->stacks, &stack_size);
+        if (stack == NULL) return NULL;
+        if (track) co_stack_clean(stack, stack_size);
+    }
+
+    // reuse a reaped corotine structure, or create a new one
+    co_run_t run = { NULL, 0, 0 };
+    co_struct_t *new_struct = _co_alloc(meta, &run, 1);
+    if (new_struct == NULL) {
+        if (stack != NULL) co_stack_free(&meta->stacks, stack, stack_size, 1);
+        return NULL;
+    }
+    *cid = _co_next_cid(new_struct);
+// printf("[dbg] start cid %d\n", *cid);
+    _co_init(meta, new_struct, stack, stack_size, !shared && track, shared);
+
+    // initalize corotine context, one on the shared stack 
+    // gets it from the copier when it is first switched to
+    if (stack != NULL) _co_ctx_make(&new_struct->ctx, 
+        new_struct->stack, new_struct->stack_size, _co_func_entry);
+    return new_struct;
+}
+
+static int _co_group_skip(co_struct_t *coro);
+
+// stack and context of a lazy routine, made by the thread about to run 
+// it; one that can't get a stack finishes at once returning -1, one of 
+// a cancelled group returning CANCELLED, and -1 is returned for both
+static int _co_materialize(co_meta_t *meta, co_struct_t *coro) {
+    if (coro->group != NULL && _co_group_skip(coro)) return -1;
+    coro->lazy = 0;
+    // one on the shared stack gets its context from the copier
+    if (coro->shared) return 0;
+    size_t stack_size = coro->stack_size;
+    void *stack = co_stack_alloc(&meta->stacks, &stack_size);
+    if (stack == NULL) {
+        _co_finish(coro, -1);
+        _co_unref(coro);
+        return -1;
+    }
+    if (coro->track) co_stack_clean(stack, stack_size);
+    coro->stack = stack;
+    coro->stack_size = stack_size;
+    _co_ctx_make(&coro->ctx, stack, stack_size, _co_func_entry);
+    return 0;
+}
+
+int co_start(co_func_t routine) {
+    // get metainfo for the current thread,
+    // which also initializes the scheduler on first use
+    co_meta_t* meta = _co_getmeta();
+    CO_NOPREEMPT(meta);
+
+    int cid;
+    co_struct_t *new_struct = _co_create(meta, &cid, (void *) routine);
+    if (new_struct == NULL) return -1;
+    new_struct->func = routine;
+    // publish the new cid last, lookups check it
+    atomic_store(&new_struct->cid, cid);
+// printf("[dbg] parent %d\n", new_struct->parent);
+    if (meta->pool != NULL) _co_pool_spawn(meta->pool, 1);
+    atomic_fetch_add(&_co_scheduler->live, 1);
+
+    // the new coroutine starts immediately, and the parent (or main)
+    // waits at the head of the run queue, so that it continues as soon 
+    // as the new one yields (or an idle worker steals it in M:N mode)
+    _co_switch(meta, new_struct, REQUEUE_FRONT);
+
+    // return cid
+    return cid;
+}
+
+static void _co_group_add(co_group_t *group, int n);
+
+// lazy routines of a group (or of none if group is NULL), made as a batch:
+// the fresh control blocks it takes are reserved as one run, sized for 
+// what is left of it, and each one gets its stack and context when it is 
+// first picked to run
+static int _co_spawn_n(co_meta_t *meta, co_group_t *group, 
+                       int (*routine)(void *), void **args, int n, 
+                       cid_t *cids) {
+    if (n <= 0) return 0;
+    int shared = _co_shared_mode(meta);
+    if (shared && _co_shared_prepare(meta) < 0) return 0;
+    co_queue_t batch = { NULL, NULL };
+    co_run_t run = { NULL, 0, 0 };
+    int count = 0;
+    for (; count < n; ++count) {
+        co_struct_t *new_struct = _co_alloc(meta, &run, n - count);
+        if (new_struct == NULL) break;
+        int track;
+        size_t stack_size = 
+            co_stack_size_for((void *) routine, &meta->stack_seed, &track);
+        _co_init(meta, new_struct, NULL, shared? 0: stack_size, 
+                 !shared && track, shared);
+        new_struct->lazy = 1;
+        new_struct->func_arg = routine;
+        new_struct->arg = args != NULL? args[count]: NULL;
+        new_struct->group = group;
+        int cid = _co_next_cid(new_struct);
+        if (cids != NULL) cids[count] = cid;
+        else {
+            // nobody could release it otherwise
+            new_struct->refs = 1;
+            new_struct->released = 1;
+        }
+        // publish the new cid last, lookups check it
+        atomic_store(&new_struct->cid, cid);
+        co_queue_push(&batch, new_struct);
+    }
+    if (count == 0) return 0;
+    // counted once for the batch, before any of them can finish
+    if (meta->pool != NULL) _co_pool_spawn(meta->pool, count);
+    if (group != NULL) _co_group_add(group, count);
+    atomic_fetch_add(&_co_scheduler->live, count);
+
+    // queued behind the runnable ones of their class in one go, 
+    // the caller goes on
+    int cls = co_class_of(batch.head);
+    co_queue_t *ready = &meta->ready[cls];
+    if (meta->pool != NULL) co_spin_lock(&meta->ready_lock);
+    if (ready->tail != NULL) ready->tail->next = batch.head;
+    else ready->head = batch.head;
+    ready->tail = batch.tail;
+    if (cls != CO_CLASS_NORMAL) meta->ready_mask |= 1u << cls;
+    if (meta->pool != NULL) {
+        co_spin_unlock(&meta->ready_lock);
+        _co_pool_notify(meta->pool);
+    }
+    return count;
+}
+
+int co_spawn(int (*routine)(void *), void *arg) {
+    co_meta_t* meta = _co_getmeta();
+    CO_NOPREEMPT(meta);
+    cid_t cid;
+    return _co_spawn_n(meta, NULL, routine, &arg, 1, &cid) == 1? cid: -1;
+}
+
+int co_spawn_n(int (*routine)(void *), void **args, int n, cid_t *cids) {
+    co_meta_t* meta = _co_getmeta();
+    CO_NOPREEMPT(meta);
+    return _co_spawn_n(meta, NULL, routine, args, n, cids);
+}
+
+// co_yield with routines of several classes around: the running routine 
+// competes with the queued ones (it would lose to all of them otherwise, 
+// being requeued only once switched out) and goes on if it wins
+static __attribute__((noinline)) 
+int _co_yield_classes(co_meta_t *meta, co_struct_t *self) {
+    co_struct_t *next;
+    _co_poll(meta);
+    do {
+        if (meta->pool != NULL) co_spin_lock(&meta->ready_lock);
+        next = _co_ready_take_classes(meta, meta->ready_mask, self);
+        if (meta->pool != NULL) co_spin_unlock(&meta->ready_lock);
+    } while (next != NULL && __builtin_expect(next->lazy, 0) && 
+             _co_materialize(meta, next) < 0);
+    if (next != NULL) _co_switch(meta, next, REQUEUE_BACK);
+    return 0;
+}
+
+int co_yield() {
+    // get metainfo for the current thread 
+    co_meta_t *meta = _co_getmeta(); 
+    CO_NOPREEMPT(meta);
+
+    // round robin: the running routine goes to the tail of the 
+    // run queue and the head one is resumed, both in O(1);
+    // when it is the only runnable one, no switch is needed
+    co_struct_t *self = meta->running;
+    if (__builtin_expect(__atomic_load_n(&meta->ready_mask, __ATOMIC_RELAXED) 
+                         != 0 || self->prio != CO_PRIO_NORMAL || self->edf, 0))
+        return _co_yield_classes(meta, self);
+    co_struct_t *next = _co_next(meta);
+    if (next != NULL) _co_switch(meta, next, REQUEUE_BACK);
+    return 0;
+}
+
+// routine with the given cid, NULL if there is no such routine
+static co_struct_t *_co_lookup(int cid) {
+    if (cid < 0) return NULL;
+    co_struct_t *coro = 
+        (co_struct_t *) co_registry_get(_cinfo, cid & CO_SLOT_MASK);
+    // the slot may have been reused (or reaped) since
+    if (coro != NULL && atomic_load(&coro->cid) != cid) coro = NULL;
+    return coro;
+}
+
+// park the running routine until qcoro finishes
+static void _co_join(co_meta_t *meta, co_struct_t *qcoro) {
+    co_struct_t *self = meta->running;
+    self->waiter.coro = self;
+    atomic_store(&self->parked, 1);
+    co_spin_lock(&qcoro->wait_lock);
+    // status is only set to FINISHED under wait_lock
+    if (_co_status(qcoro) == FINISHED) {
+        co_spin_unlock(&qcoro->wait_lock);
+        atomic_store(&self->parked, 0);
+        return;
+    }
+    co_waiter_link(&qcoro->waiters, &self->waiter);
+    co_spin_unlock(&qcoro->wait_lock);
+    long long start = _co_prof_clock();
+    _co_park(meta);
+    if (start != 0) self->wait_ns += _co_now() - start;
+}
+
+int co_getret(int cid) {
+    co_meta_t *meta = _co_getmeta();
+    CO_NOPREEMPT(meta);
+    co_struct_t *qcoro = _co_lookup(cid);
+    if (qcoro == NULL) return -1;
+
+    unsigned long long state = 
+        atomic_load_explicit(&qcoro->state, memory_order_acquire);
+    if (CO_STATE_STATUS(state) != FINISHED) {
+        _co_join(meta, qcoro);
+        state = atomic_load_explicit(&qcoro->state, memory_order_acquire);
+    }
+    return CO_STATE_RET(state);
+}
+
+// get UNAUTHORIZED when:
+// 1. invalid cid is provided
+// 2. two routines aren't in the same thread (or worker pool)
+// 3. current routine isn't a PARENT or ANCESTOR of queried routine
+int co_status(int cid) {
+    co_meta_t *meta = _co_getmeta();
+    co_struct_t *qcoro = _co_lookup(cid);
+    if (qcoro == NULL) return UNAUTHORIZED;
+
+    // routines of a worker pool may run on any of its threads
+    int same_thread = qcoro->pool != NULL? qcoro->pool == meta->pool: 
+        meta->pool == NULL && pthread_equal(qcoro->tid, _thread_id);
+    if (same_thread) {
+        if (meta->running == &meta->main) return _co_status(qcoro);
+        // the chain stops at a parent that is already reaped
+        co_struct_t *coro = qcoro;
+        for (; coro != NULL; coro = _co_lookup(coro->parent)) {
+            if (coro == meta->running) return _co_status(qcoro);
+        }
+    }
+    return UNAUTHORIZED;
+}
+
+int co_wait(int cid) {
+    co_meta_t *meta = _co_getmeta();
+    CO_NOPREEMPT(meta);
+    co_struct_t *qcoro = _co_lookup(cid);
+    if (qcoro == NULL) return -1;
+
+    if (_co_status(qcoro) != FINISHED) _co_join(meta, qcoro);
+    return 0;
+}
+
+// Joining several routines at once: the caller links a waiter of its own 
+// into each of them and parks once. With co_wait_any the first one to 
+// finish wakes it (later ones find it no longer parked), then it withdraws
+// from the others; with co_wait_all_of the waiters share a count of 
+// targets still running, and only the last one to finish wakes it. Either 
+// way it costs O(n) in all, not per scheduling turn. The waiters live off 
+// the stack, which may be the shared one in copy-stack mode.
+
+typedef struct co_join_set_t {
+    _Atomic int pending;
+    co_struct_t **targets;
+        // points right behind the waiters, in the same allocation
+    co_waiter_t waiters[];
+} co_join_set_t;
+
+// waiters for the routines of n cids, NULL if any cid is invalid
+static co_join_set_t *_co_join_set(cid_t *cids, int n) {
+    if (n <= 0) return NULL;
+    co_join_set_t *set = (co_join_set_t *) malloc(sizeof(co_join_set_t) + 
+        (sizeof(co_waiter_t) + sizeof(co_struct_t *)) * n);
+    if (set == NULL) return NULL;
+    set->targets = (co_struct_t **) (set->waiters + n);
+    for (int i = 0; i < n; ++i) {
+        // cids handed out all fit in an int
+        if (cids[i] == (int) cids[i] && 
+            (set->targets[i] = _co_lookup((int) cids[i])) != NULL) continue;
+        free(set);
+        return NULL;
+    }
+    return set;
+}
+
+int co_wait_any(cid_t *cids, int n, int *which) {
+    co_meta_t *meta = _co_getmeta();
+    CO_NOPREEMPT(meta);
+    co_struct_t *self = meta->running;
+    co_join_set_t *set = _co_join_set(cids, n);
+    if (set == NULL) return -1;
+    co_struct_t **targets = set->targets;
+    atomic_store(&self->parked, 1);
+    int linked = 0, done = -1;
+    for (; linked < n; ++linked) {
+        co_waiter_t *waiter = &set->waiters[linked];
+        waiter->coro = self;
+        waiter->pending = NULL;
+        co_spin_lock(&targets[linked]->wait_lock);
+        // status is only set to FINISHED under wait_lock
+        if (_co_status(targets[linked]) == FINISHED) {
+            co_spin_unlock(&targets[linked]->wait_lock);
+            done = linked;
+            break;
+        }
+        co_waiter_link(&targets[linked]->waiters, waiter);
+        co_spin_unlock(&targets[linked]->wait_lock);
+    }
+    if (done < 0) {
+        long long start = _co_prof_clock();
+        _co_park(meta);
+        if (start != 0) self->wait_ns += _co_now() - start;
+    } else if (!atomic_exchange(&self->parked, 0)) {
+        // one linked already has woken it up, take that wake-up
+        _co_park(meta);
+    }
+
+    // withdraw from those still running, the others have emptied their list;
+    // one of them may have finished after being linked, below the one found 
+    // finished while linking
+    for (int i = 0; i < linked; ++i) {
+        co_spin_lock(&targets[i]->wait_lock);
+        if (_co_status(targets[i]) != FINISHED) 
+            co_waiter_unlink(&targets[i]->waiters, &set->waiters[i]);
+        else if (done < 0 || i < done) done = i;
+        co_spin_unlock(&targets[i]->wait_lock);
+    }
+    if (which != NULL) *which = done;
+    free(set);
+    return 0;
+}
+
+int co_wait_all_of(cid_t *cids, int n) {
+    co_meta_t *meta = _co_getmeta();
+    CO_NOPREEMPT(meta);
+    co_struct_t *self = meta->running;
+    co_join_set_t *set = _co_join_set(cids, n);
+    if (set == NULL) return -1;
+    co_struct_t **targets = set->targets;
+    // one extra count keeps the targets from waking it before all are linked
+    atomic_store(&set->pending, 1);
+    atomic_store(&self->parked, 1);
+    for (int i = 0; i < n; ++i) {
+        co_waiter_t *waiter = &set->waiters[i];
+        waiter->coro = self;
+        waiter->pending = &set->pending;
+        co_spin_lock(&targets[i]->wait_lock);
+        if (_co_status(targets[i]) != FINISHED) {
+            atomic_fetch_add(&set->pending, 1);
+            co_waiter_link(&targets[i]->waiters, waiter);
+        }
+        co_spin_unlock(&targets[i]->wait_lock);
+    }
+    if (atomic_fetch_sub(&set->pending, 1) == 1) {
+        atomic_store(&self->parked, 0);
+    } else {
+        long long start = _co_prof_clock();
+        _co_park(meta);
+        if (start != 0) self->wait_ns += _co_now() - start;
+    }
+    free(set);
+    return 0;
+}
+
+int co_waitall() {
+    co_meta_t *meta = _co_getmeta();
+    CO_NOPREEMPT(meta);
+    co_struct_t *self = meta->running;
+    self->waiter.coro = self;
+
+    if (atomic_load(&_co_scheduler->live) == 0) return 0;
+    atomic_store(&self->parked, 1);
+    co_spin_lock(&_co_scheduler->idle_lock);
+    atomic_fetch_add(&_co_scheduler->nidle, 1);
+    // live drops to zero before nidle is checked by the last routine
+    if (atomic_load(&_co_scheduler->live) == 0) {
+        atomic_fetch_sub(&_co_scheduler->nidle, 1);
+        co_spin_unlock(&_co_scheduler->idle_lock);
+        atomic_store(&self->parked, 0);
+        return 0;
+    }
+    co_waiter_link(&_co_scheduler->idle_waiters, &self->waiter);
+    co_spin_unlock(&_co_scheduler->idle_lock);
+    _co_park(meta);
+    return 0;
+}
+
+int co_release(int cid) {
+    CO_NOPREEMPT(_co_getmeta());
+    co_struct_t *qcoro = _co_lookup(cid);
+    if (qcoro == NULL || atomic_exchange(&qcoro->released, 1)) return -1;
+    _co_unref(qcoro);
+    return 0;
+}
+
+// the running routine by its own cid, which also covers main (-1)
+static co_struct_t *_co_lookup_self(co_meta_t *meta, int cid) {
+    return cid == meta->running->cid? meta->running: _co_lookup(cid);
+}
+
+int co_setprio(int cid, int prio) {
+    co_meta_t *meta = _co_getmeta();
+    co_struct_t *qcoro = _co_lookup_self(meta, cid);
+    if (qcoro == NULL || prio < CO_PRIO_HIGH || prio > CO_PRIO_LOW) return -1;
+    qcoro->prio = prio;
+    return 0;
+}
+
+int co_setdeadline(int cid, long long ns) {
+    co_meta_t *meta = _co_getmeta();
+    co_struct_t *qcoro = _co_lookup_self(meta, cid);
+    if (qcoro == NULL) return -1;
+    if (ns > 0) qcoro->deadline = _co_now() + ns;
+    qcoro->edf = ns > 0;
+    return 0;
+}
+
+/* Implementation of Task Groups */
+
+// A group counts its members not finished yet, the last one to finish 
+// wakes up the routines parked in co_group_join, and joining never looks 
+// at the members themselves. Members are lazy routines: cancelling sets a
+// flag, and finishes the members that haven't started as CANCELLED at 
+// once, in bulk, if they are queued where the caller can reach them: on 
+// its own thread, or on any worker of its pool. Others (queued on other 
+// threads, or on their way to a queue) are finished so when they are 
+// picked to run, before getting a stack.
+
+struct co_group_t {
+    _Atomic int pending;
+        // members not finished yet
+    _Atomic int cancelled;
+    _Atomic int skipped;
+        // members finished by a cancellation without having run
+    co_spin_t lock;
+    co_waiter_t *waiters;
+        // routines parked in co_group_join, pending only drops to 
+        // zero under lock, thus none is left behind, and no member 
+        // touches the group any more once a joiner sees it at zero
+};
+
+static void _co_group_add(co_group_t *group, int n) {
+    atomic_fetch_add(&group->pending, n);
+}
+
+static void _co_group_done(co_group_t *group, int n) {
+    // only the last ones take the lock
+    int pending = atomic_load_explicit(&group->pending, memory_order_relaxed);
+    while (pending > n)
+        if (atomic_compare_exchange_weak(&group->pending, &pending, pending - n))
+            return;
+    co_spin_lock(&group->lock);
+    co_waiter_t *waiters = NULL;
+    if (atomic_fetch_sub(&group->pending, n) == n) {
+        waiters = group->waiters;
+        group->waiters = NULL;
+    }
+    // a joiner may free the group once this is released
+    co_spin_unlock(&group->lock);
+    for (co_waiter_t *next; waiters != NULL; waiters = next) {
+        next = waiters->next;
+        _co_unpark(waiters->coro);
+    }
+}
+
+// finish a member that hasn't started if its group is cancelled
+static int _co_group_skip(co_struct_t *coro) {
+    co_group_t *group = coro->group;
+    if (!atomic_load_explicit(&group->cancelled, memory_order_relaxed)) 
+        return 0;
+    atomic_fetch_add(&group->skipped, 1);
+    _co_finish(coro, CANCELLED);
+    _co_unref(coro);
+    return 1;
+}
+
+co_group_t *co_group_create() {
+    return (co_group_t *) calloc(1, sizeof(co_group_t));
+}
+
+int co_group_spawn(co_group_t *group, int (*routine)(void *), void *arg) {
+    co_meta_t *meta = _co_getmeta();
+    CO_NOPREEMPT(meta);
+    return _co_spawn_n(meta, group, routine, &arg, 1, NULL) == 1? 0: -1;
+}
+
+int co_group_spawn_n(co_group_t *group, int (*routine)(void *), 
+                     void **args, int n) {
+    co_meta_t *meta = _co_getmeta();
+    CO_NOPREEMPT(meta);
+    return _co_spawn_n(meta, group, routine, args, n, NULL);
+}
+
+int co_group_join(co_group_t *group) {
+    co_meta_t *meta = _co_getmeta();
+    CO_NOPREEMPT(meta);
+    co_struct_t *self = meta->running;
+    self->waiter.coro = self;
+    atomic_store(&self->parked, 1);
+    co_spin_lock(&group->lock);
+    if (atomic_load(&group->pending) == 0) {
+        co_spin_unlock(&group->lock);
+        atomic_store(&self->parked, 0);
+    } else {
+        co_waiter_link(&group->waiters, &self->waiter);
+        co_spin_unlock(&group->lock);
+        _co_park(meta);
+    }
+    return atomic_load(&group->skipped);
+}
+
+// finish the members of group queued on meta that haven't started, 
+// unlinking them in the same walk while they are in the cache; they are 
+// counted as finished by the caller, returns how many (under ready_lock 
+// in M:N mode, having no waiters nobody is woken)
+static int _co_group_unqueue(co_meta_t *meta, co_group_t *group) {
+    int n = 0;
+    for (int cls = CO_CLASS_EDF + 1; cls < CO_CLASSES; ++cls) {
+        co_queue_t *ready = &meta->ready[cls];
+        co_struct_t *prev = NULL;
+        for (co_struct_t *coro = ready->head, *next; coro != NULL; 
+             coro = next) {
+            next = coro->next;
+            if (!coro->lazy || coro->group != group) {
+                prev = coro;
+                continue;
+            }
+            if (prev != NULL) prev->next = next;
+            else ready->head = next;
+            if (ready->tail == coro) ready->tail = prev;
+            _co_finish_state(coro, CANCELLED);
+            _co_unref(coro);
+            ++n;
+        }
+        if (ready->head == NULL && cls != CO_CLASS_NORMAL) 
+            meta->ready_mask &= ~(1u << cls);
+    }
+    return n;
+}
+
+static int _co_pool_unqueue(co_pool_t *pool, co_group_t *group);
+
+int co_group_cancel(co_group_t *group) {
+    co_meta_t *meta = _co_getmeta();
+    CO_NOPREEMPT(meta);
+    atomic_store(&group->cancelled, 1);
+    int n = meta->pool == NULL? _co_group_unqueue(meta, group): 
+            _co_pool_unqueue(meta->pool, group);
+    if (n == 0) return 0;
+    // counted at once, the skipped ones first: joiners return them as 
+    // soon as pending drops to zero
+    atomic_fetch_add(&group->skipped, n);
+    _co_finish_count(group, meta->pool, n);
+    return 0;
+}
+
+int co_cancelled() {
+    co_group_t *group = _co_getmeta()->running->group;
+    return group != NULL && 
+           atomic_load_explicit(&group->cancelled, memory_order_relaxed);
+}
+
+void co_group_destroy(co_group_t *group) {
+    free(group);
+}
+
+/* Implementation of Coroutine-Local Storage */
+
+// Keys are indices into the values of a routine: the first CO_LOCAL_INLINE
+// values live in the control block, later keys spill into an array grown 
+// on demand, thus a lookup is a bounds check and a load or two off the 
+// running routine, with no lock nor hashing. Keys are never deleted. A 
+// routine's values are destructed (one round, like pthread keys) when it 
+// returns, the main routine's at thread exit, a generator's when its 
+// function returns or it is destroyed.
+
+static void (*_co_key_dtors[CO_KEYS_MAX])(void *);
+static _Atomic int _co_nkeys;
+
+int co_key_create(co_key_t *key, void (*destructor)(void *)) {
+    int n = atomic_load(&_co_nkeys);
+    do if (n >= CO_KEYS_MAX) return -1;
+    while (!atomic_compare_exchange_weak(&_co_nkeys, &n, n + 1));
+    // the key isn't known to anyone before it is returned
+    _co_key_dtors[n] = destructor;
+    *key = n;
+    return 0;
+}
+
+void *co_getspecific(co_key_t key) {
+    co_struct_t *self = _co_getmeta()->running;
+    unsigned int idx = key;
+    if (idx < CO_LOCAL_INLINE) return self->local[idx];
+    idx -= CO_LOCAL_INLINE;
+    return idx < (unsigned int) self->local_cap? self->local_spill[idx]: NULL;
+}
+
+static __attribute__((noinline)) int _co_local_grow(co_struct_t *coro, 
+                                                    int cap) {
+    if (cap < 2 * coro->local_cap) cap = 2 * coro->local_cap;
+    void **spill = (void **) realloc(coro->local_spill, sizeof(void *) * cap);
+    if (spill == NULL) return -1;
+    memset(spill + coro->local_cap, 0, 
+           sizeof(void *) * (cap - coro->local_cap));
+    coro->local_spill = spill;
+    coro->local_cap = cap;
+    return 0;
+}
+
+int co_setspecific(co_key_t key, const void *value) {
+    co_struct_t *self = _co_getmeta()->running;
+    unsigned int idx = key;
+    if (idx >= (unsigned int) atomic_load_explicit(&_co_nkeys, 
+                                                   memory_order_relaxed)) 
+        return -1;
+    if (idx < CO_LOCAL_INLINE) {
+        self->local[idx] = (void *) value;
+        return 0;
+    }
+    idx -= CO_LOCAL_INLINE;
+    if (idx >= (unsigned int) self->local_cap && 
+        _co_local_grow(self, idx + 1) < 0) return -1;
+    self->local_spill[idx] = (void *) value;
+    return 0;
+}
+
+// destruct the values of a routine that is done with them, 
+// values set by the destructors themselves are dropped
+static void _co_local_clear(co_struct_t *coro) {
+    for (int key = 0; key < CO_LOCAL_INLINE + coro->local_cap; ++key) {
+        void **slot = key < CO_LOCAL_INLINE? &coro->local[key]: 
+            &coro->local_spill[key - CO_LOCAL_INLINE];
+        void *value = *slot;
+        if (value == NULL) continue;
+        *slot = NULL;
+        if (_co_key_dtors[key] != NULL) _co_key_dtors[key](value);
+    }
+    for (int key = 0; key < CO_LOCAL_INLINE; ++key) coro->local[key] = NULL;
+    free(coro->local_spill);
+    coro->local_spill = NULL;
+    coro->local_cap = 0;
+}
+
+/* Implementation of Generators */
+
+// A generator runs on its own stack with its own context, but it is no 
+// routine: it has no cid, is never queued, and isn't waited for by 
+// co_waitall. co_gen_next switches straight to it, and co_yield_value 
+// straight back to the caller, without going through the run queue; the 
+// caller meanwhile is suspended just like a parked routine. A generator 
+// may still park (on I/O, a channel...), then the thread runs others 
+// until it is woken up, and the caller keeps waiting for its value.
+
+struct co_gen_t {
+    co_struct_t coro;
+        // context and stack of the generator
+    co_struct_t *caller;
+        // routine waiting in co_gen_next
+    int (*func)(void *);
+    void *arg;
+    long value;
+        // the last value yielded
+    int done;
+        // set once func has returned
+};
+
+// the only place generators and their callers switch from, in both 
+// directions: a switch then returns to the very call site the return 
+// stack buffer predicts, and co_yield_value tail-calls it, leaving a 
+// single mispredicted return per switch like co_yield
+static __attribute__((noinline)) int _co_gen_transfer(co_struct_t *to) {
+    _co_switch(_co_curmeta(), to, REQUEUE_NONE);
+    return 0;
+}
+
+static void _co_gen_entry(void) {
+    co_meta_t *meta = _co_curmeta();
+    _co_after_switch(meta);
+    co_gen_t *gen = meta->running->gen;
+    gen->func(gen->arg);
+    _co_local_clear(&gen->coro);
+    gen->done = 1;
+    // never to be resumed, its stack is freed by co_gen_destroy
+    _co_gen_transfer(gen->caller);
+}
+
+co_gen_t *co_gen_start(int (*func)(void *), void *arg) {
+    co_meta_t *meta = _co_getmeta();
+    CO_NOPREEMPT(meta);
+    co_gen_t *gen = (co_gen_t *) aligned_alloc(_Alignof(co_gen_t), sizeof(co_gen_t));
+    if (gen == NULL) return NULL;
+    memset(gen, 0, sizeof(co_gen_t));
+    size_t stack_size = _co_stack_size;
+    void *stack = co_stack_alloc(&meta->stacks, &stack_size);
+    if (stack == NULL) {
+        free(gen);
+        return NULL;
+    }
+    gen->coro.cid = -1;
+    gen->coro.stack = stack;
+    gen->coro.stack_size = stack_size;
+    gen->coro.tid = _thread_id;
+    gen->coro.pool = meta->pool;
+    _co_state_set(&gen->coro, RUNNING, -1);
+    gen->coro.gen = gen;
+    // a generator only runs for its caller, which isn't queued meanwhile
+    gen->coro.nopreempt = 1;
+    gen->func = func;
+    gen->arg = arg;
+    _co_ctx_make(&gen->coro.ctx, stack, stack_size, _co_gen_entry);
+    return gen;
+}
+
+int co_gen_next(co_gen_t *gen, long *value) {
+    if (gen->done) return 0;
+    co_meta_t *meta = _co_getmeta();
+    CO_NOPREEMPT(meta);
+    gen->caller = meta->running;
+    _co_gen_transfer(&gen->coro);
+    if (gen->done) return 0;
+    if (value != NULL) *value = gen->value;
+    return 1;
+}
+
+int co_yield_value(long value) {
+    co_gen_t *gen = _co_getmeta()->running->gen;
+    if (gen == NULL) return -1;
+    gen->value = value;
+    return _co_gen_transfer(gen->caller);
+}
+
+void co_gen_destroy(co_gen_t *gen) {
+    if (gen == NULL) return;
+    co_meta_t *meta = _co_getmeta();
+    CO_NOPREEMPT(meta);
+    // it is suspended (or done), nobody runs on its stack any more
+    _co_local_clear(&gen->coro);
+    co_stack_free(&meta->stacks, gen->coro.stack, gen->coro.stack_size, 1);
+    free(gen);
+}
+
+/* Implementation of Copy-Stack Mode */
+
+// Routines started in copy-stack mode all run on one large stack per 
+// thread. The one whose frames are on it (shared_owner) leaves them there 
+// when suspended; only when another routine of the shared stack is to run 
+// are they copied into a buffer of the owner's right-sized to its live 
+// depth, and the frames of the next one copied back in. That is done by 
+// the copier, a context on a small stack of its own, since no routine can 
+// overwrite the stack it runs on, and the owner's frames are complete only 
+// once it has switched away. An idle routine thus costs its control block 
+// plus its live stack depth, and a switch to one costs two context swaps 
+// and copying both depths, while switching back to the owner is as cheap 
+// as ever.
+
+#ifdef CO_CTX_ASM
+
+static inline int _co_on_shared_stack(co_meta_t *meta, void *ptr) {
+    return (char *) ptr >= (char *) meta->shared_stack &&
+           (char *) ptr < (char *) meta->shared_stack + meta->shared_size;
+}
+
+// move the frames of a suspended routine off the shared stack
+static void _co_stack_save(co_struct_t *coro, char *top) {
+    size_t size = top - (char *) coro->ctx.sp;
+    // keep the buffer within twice the live depth
+    if (size > coro->saved_cap || size < coro->saved_cap / 2) {
+        free(coro->saved);
+        coro->saved_cap = (size + 63) & ~(size_t) 63;
+        coro->saved = malloc(coro->saved_cap);
+        // nowhere to report it to, and the frames would be lost
+        if (coro->saved == NULL) abort();
+    }
+    memcpy(coro->saved, coro->ctx.sp, size);
+    coro->saved_size = size;
+}
+
+static void _co_copier_entry(void) {
+    for (;;) {
+        // routines on the shared stack never leave the thread
+        co_meta_t *meta = _co_curmeta();
+        co_struct_t *coro = meta->copy_to;
+        char *top = (char *) meta->shared_stack + meta->shared_size;
+        if (meta->shared_owner != NULL) _co_stack_save(meta->shared_owner, top);
+        // a routine that has never run has nothing saved
+        if (coro->saved_size == 0) {
+            _co_ctx_make(&coro->ctx, 
+                meta->shared_stack, meta->shared_size, _co_func_entry);
+        } else {
+            memcpy(top - coro->saved_size, coro->saved, coro->saved_size);
+        }
+        meta->shared_owner = coro;
+        // the resumed routine finishes the switch as usual
+        _co_ctx_swap(&meta->copier, &coro->ctx);
+    }
+}
+
+// set up the shared stack and the copier of this thread on first use,
+// the size of the shared stack is fixed from then on
+static int _co_shared_prepare(co_meta_t *meta) {
+    if (meta->shared_stack != NULL) return 0;
+    size_t size = _co_shared_stack_size, copier_size = CO_COPIER_STACK;
+    void *stack = co_stack_alloc(&meta->stacks, &size);
+    if (stack == NULL) return -1;
+    void *copier = co_stack_alloc(&meta->stacks, &copier_size);
+    if (copier == NULL) {
+        co_stack_free(&meta->stacks, stack, size, 1);
+        return -1;
+    }
+    _co_ctx_make(&meta->copier, copier, copier_size, _co_copier_entry);
+    meta->copier_stack = copier;
+    meta->shared_stack = stack;
+    meta->shared_size = size;
+    return 0;
+}
+
+#else
+
+static inline int _co_on_shared_stack(co_meta_t *meta, void *ptr) {
+    return 0;
+}
+
+static int _co_shared_prepare(co_meta_t *meta) {
+    return -1;
+}
+
+#endif
+
+/* Implementation of Async I/O */
+
+// Every thread that waits on an fd gets its own epoll instance, fds are 
+// registered once (edge-triggered, for both directions) into the instance 
+// of the thread waiting on them. An I/O call first tries the non-blocking
+// system call, and only on EAGAIN parks on the fd until the poller marks 
+// it ready. Each direction of an fd holds either NULL, CO_IO_READY (an 
+// edge came in since the last attempt) or the routine parked on it, thus 
+// an edge racing with a routine going to park is never lost.
+
+#define CO_IO_READY ((co_struct_t *) 1)
+#define CO_NETPOLL_EVENTS (128)
+
+typedef struct co_fd_t {
+    _Atomic(co_struct_t *) rd;
+    _Atomic(co_struct_t *) wr;
+        // readiness or the routine waiting, for reading and writing
+    _Atomic unsigned int epoll_gen;
+        // epoll_gen of the thread the fd was last registered with, 0 if none
+    _Atomic int nonblock;
+        // whether O_NONBLOCK has been set on the fd
+} co_fd_t;
+
+// wait state of an fd, created on first use
+static co_fd_t *_co_fd(int fd) {
+    if (fd < 0 || fd >= REGISTRY_CAP) return NULL;
+    co_registry_value_t *slot = co_registry_slot(&_co_scheduler->fds, fd, 1);
+    co_fd_t *f = (co_fd_t *) __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (f == NULL) {
+        co_fd_t *new_f = (co_fd_t *) calloc(1, sizeof(co_fd_t));
+        co_registry_value_t expected = NULL;
+        if (__atomic_compare_exchange_n(slot, &expected, new_f, 0, 
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) f = new_f;
+        else free(new_f), f = (co_fd_t *) expected;
+    }
+    return f;
+}
+
+// forget whatever a former fd of the same number left behind
+static void _co_fd_reset(co_fd_t *f) {
+    atomic_store(&f->rd, NULL);
+    atomic_store(&f->wr, NULL);
+    atomic_store(&f->epoll_gen, 0);
+    atomic_store(&f->nonblock, 0);
+}
+
+static co_fd_t *_co_fd_prepare(int fd) {
+    _co_getmeta();
+    co_fd_t *f = _co_fd(fd);
+    if (f == NULL) {
+        errno = EBADF;
+        return NULL;
+    }
+    if (!atomic_load_explicit(&f->nonblock, memory_order_relaxed)) {
+        int flags = fcntl(fd, F_GETFL);
+        if (flags < 0) return NULL;
+        if (!(flags & O_NONBLOCK) && fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+            return NULL;
+        atomic_store(&f->nonblock, 1);
+    }
+    return f;
+}
+
+static void _co_io_ready(_Atomic(co_struct_t *) *slot) {
+    co_struct_t *waiter = atomic_exchange(slot, CO_IO_READY);
+    if (waiter != NULL && waiter != CO_IO_READY) _co_unpark(waiter);
+}
+
+// poll the fds of this thread and wake up the routines parked on 
+// them, blocking for at most timeout ms; returns the number of events
+static int _co_netpoll(co_meta_t *meta, int timeout) {
+    struct epoll_event events[CO_NETPOLL_EVENTS];
+    int n = epoll_wait(meta->epfd, events, CO_NETPOLL_EVENTS, timeout);
+    for (int i = 0; i < n; ++i) {
+        co_fd_t *f = (co_fd_t *) events[i].data.ptr;
+        if (f == NULL) {
+            // the eventfd of _co_idle_wake
+            eventfd_t value;
+            eventfd_read(meta->evfd, &value);
+            continue;
+        }
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            _co_io_ready(&f->rd);
+        if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+            _co_io_ready(&f->wr);
+    }
+    return n > 0? n: 0;
+}
+
+// park the running routine until fd is ready in the direction of slot;
+// returns 0 once the operation is worth another try, -1 on error
+static int _co_io_wait(int fd, co_fd_t *f, _Atomic(co_struct_t *) *slot) {
+    co_meta_t *meta = _co_getmeta();
+    co_struct_t *self = meta->running;
+    if (meta->epfd < 0) {
+        int epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epfd < 0) return -1;
+        int evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+        if (evfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, evfd, &event) < 0) {
+            int err = errno;
+            if (evfd >= 0) close(evfd);
+            close(epfd);
+            errno = err;
+            return -1;
+        }
+        meta->epfd = epfd, meta->evfd = evfd;
+        // a former thread's epfd may have had the same number
+        meta->epoll_gen = atomic_fetch_add(&_co_scheduler->epoll_gen, 1) + 1;
+    }
+    if (atomic_load_explicit(&f->epoll_gen, memory_order_relaxed) != 
+        meta->epoll_gen) {
+        struct epoll_event event = {
+            .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+            .data.ptr = f,
+        };
+        if (epoll_ctl(meta->epfd, EPOLL_CTL_ADD, fd, &event) < 0 &&
+            (errno != EEXIST || 
+             epoll_ctl(meta->epfd, EPOLL_CTL_MOD, fd, &event) < 0)) 
+            return -1;
+        atomic_store(&f->epoll_gen, meta->epoll_gen);
+    }
+
+    atomic_store(&self->parked, 1);
+    atomic_fetch_add(&meta->nio, 1);
+    co_struct_t *expected = NULL;
+    if (atomic_compare_exchange_strong(slot, &expected, self)) {
+        // the poller of this thread wakes it up, wherever it resumes
+        _co_park(meta);
+        atomic_fetch_sub(&meta->nio, 1);
+        return 0;
+    }
+    atomic_fetch_sub(&meta->nio, 1);
+    atomic_store(&self->parked, 0);
+    if (expected != CO_IO_READY) {
+        errno = EBUSY;
+        return -1;
+    }
+    // an edge came in since the last attempt, consume it and try again
+    atomic_store(slot, NULL);
+    return 0;
+}
+
+#define CO_IO_AGAIN() (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+
+ssize_t co_read(int fd, void *buf, size_t count) {
+    CO_NOPREEMPT(_co_getmeta());
+    co_fd_t *f = _co_fd_prepare(fd);
+    if (f == NULL) return -1;
+    for (;;) {
+        ssize_t n = read(fd, buf, count);
+        if (n >= 0 || !CO_IO_AGAIN()) return n;
+        if (_co_io_wait(fd, f, &f->rd) < 0) return -1;
+    }
+}
+
+ssize_t co_write(int fd, const void *buf, size_t count) {
+    CO_NOPREEMPT(_co_getmeta());
+    co_fd_t *f = _co_fd_prepare(fd);
+    if (f == NULL) return -1;
+    size_t done = 0;
+    while (done < count) {
+        ssize_t n = write(fd, (const char *) buf + done, count - done);
+        if (n >= 0) done += n;
+        else if (!CO_IO_AGAIN()) return done > 0? (ssize_t) done: -1;
+        else if (_co_io_wait(fd, f, &f->wr) < 0) return -1;
+    }
+    return done;
+}
+
+int co_accept(int fd, struct sockaddr *addr, socklen_t *addrlen) {
+    CO_NOPREEMPT(_co_getmeta());
+    co_fd_t *f = _co_fd_prepare(fd);
+    if (f == NULL) return -1;
+    for (;;) {
+        int conn = accept4(fd, addr, addrlen, SOCK_NONBLOCK);
+        if (conn >= 0) {
+            co_fd_t *c = _co_fd(conn);
+            if (c != NULL) {
+                _co_fd_reset(c);
+                atomic_store(&c->nonblock, 1);
+            }
+            return conn;
+        }
+        if (!CO_IO_AGAIN() && errno != ECONNABORTED) return -1;
+        if (_co_io_wait(fd, f, &f->rd) < 0) return -1;
+    }
+}
+
+int co_connect(int fd, const struct sockaddr *addr, socklen_t addrlen) {
+    CO_NOPREEMPT(_co_getmeta());
+    co_fd_t *f = _co_fd(fd);
+    if (f != NULL) _co_fd_reset(f);
+    if ((f = _co_fd_prepare(fd)) == NULL) return -1;
+    // connect reports EALREADY while in progress and EISCONN once done
+    int ret = connect(fd, addr, addrlen);
+    while (ret < 0 && (errno == EINPROGRESS || errno == EALREADY || 
+                       errno == EINTR)) {
+        if (_co_io_wait(fd, f, &f->wr) < 0) return -1;
+        ret = connect(fd, addr, addrlen);
+    }
+    if (ret < 0 && errno == EISCONN) ret = 0;
+    return ret;
+}
+
+int co_close(int fd) {
+    CO_NOPREEMPT(_co_getmeta());
+    co_fd_t *f = _co_fd(fd);
+    int ret = close(fd);
+    if (f != NULL) {
+        // routines still parked on it retry and fail with EBADF
+        co_struct_t *rd = atomic_exchange(&f->rd, NULL);
+        co_struct_t *wr = atomic_exchange(&f->wr, NULL);
+        _co_fd_reset(f);
+        if (rd != NULL && rd != CO_IO_READY) _co_unpark(rd);
+        if (wr != NULL && wr != CO_IO_READY) _co_unpark(wr);
+    }
+    return ret;
+}
+
+/* Implementation of Blocking Calls */
+
+// co_blocking queues fn(arg) for a pool of helper threads and parks the 
+// caller; the helper that runs it unparks the caller, which is resumed by 
+// its own thread (or pool) through the inbox, waking it up if idle. Helpers
+// have no meta information of their own and never run routines. They are 
+// started as calls queue up, up to _co_blocking_max at a time, and then 
+// wait for more; surplus ones exit once co_set_blocking_threads lowers the
+// limit. All signals are blocked in helpers, preemption and profiling 
+// ticks only ever land on threads running routines.
+
+typedef struct co_blocking_call_t {
+    struct co_blocking_call_t *next;
+        // link in the queue of calls waiting for a helper
+    long (*fn)(void *);
+    void *arg;
+    long ret;
+    int err;
+        // result of the call, and errno after it
+    co_struct_t *coro;
+        // the routine parked on it
+} co_blocking_call_t;
+
+static pthread_mutex_t _co_blocking_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _co_blocking_cond = PTHREAD_COND_INITIALIZER;
+    // helpers wait on _co_blocking_cond for calls to queue up
+static co_blocking_call_t *_co_blocking_head, *_co_blocking_tail;
+static int _co_blocking_queued;
+    // calls not picked up by a helper yet, oldest first
+static int _co_blocking_threads, _co_blocking_busy;
+    // helpers alive, and those running a call
+static int _co_blocking_max = CO_BLOCKING_THREADS;
+
+static void *_co_blocking_helper(void *ptr) {
+    pthread_mutex_lock(&_co_blocking_lock);
+    for (;;) {
+        while (_co_blocking_head == NULL && 
+               _co_blocking_threads <= _co_blocking_max)
+            pthread_cond_wait(&_co_blocking_cond, &_co_blocking_lock);
+        if (_co_blocking_threads > _co_blocking_max) break;
+        co_blocking_call_t *call = _co_blocking_head;
+        _co_blocking_head = call->next;
+        if (_co_blocking_head == NULL) _co_blocking_tail = NULL;
+        _co_blocking_queued--, _co_blocking_busy++;
+        pthread_mutex_unlock(&_co_blocking_lock);
+
+        call->ret = call->fn(call->arg);
+        call->err = errno;
+        // the caller frees the call once resumed
+        _co_unpark(call->coro);
+
+        pthread_mutex_lock(&_co_blocking_lock);
+        _co_blocking_busy--;
+    }
+    _co_blocking_threads--;
+    pthread_mutex_unlock(&_co_blocking_lock);
+    return NULL;
+}
+
+// start a helper, under _co_blocking_lock; -1 on failure
+static int _co_blocking_spawn() {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    sigset_t all, old;
+    sigfillset(&all);
+    // the new thread inherits the signal mask
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_t thread;
+    int ret = pthread_create(&thread, &attr, _co_blocking_helper, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) return -1;
+    _co_blocking_threads++;
+    return 0;
+}
+
+// queue a call, starting a helper for it if all are busy; 
+// -1 if there is no helper and none can be started
+static int _co_blocking_submit(co_blocking_call_t *call) {
+    pthread_mutex_lock(&_co_blocking_lock);
+    int idle = _co_blocking_threads - _co_blocking_busy - _co_blocking_queued;
+    if (idle <= 0 && _co_blocking_threads < _co_blocking_max && 
+        _co_blocking_spawn() < 0 && _co_blocking_threads == 0) {
+        pthread_mutex_unlock(&_co_blocking_lock);
+        return -1;
+    }
+    call->next = NULL;
+    if (_co_blocking_tail != NULL) _co_blocking_tail->next = call;
+    else _co_blocking_head = call;
+    _co_blocking_tail = call;
+    _co_blocking_queued++;
+    pthread_cond_signal(&_co_blocking_cond);
+    pthread_mutex_unlock(&_co_blocking_lock);
+    return 0;
+}
+
+long co_blocking(long (*fn)(void *), void *arg) {
+    co_meta_t *meta = _co_getmeta();
+    CO_NOPREEMPT(meta);
+    co_struct_t *self = meta->running;
+    // not on the stack, which may be the shared one in copy-stack mode
+    co_blocking_call_t *call = 
+        (co_blocking_call_t *) malloc(sizeof(co_blocking_call_t));
+    if (call == NULL) return fn(arg);
+    call->fn = fn, call->arg = arg;
+    call->coro = self;
+    atomic_store(&self->parked, 1);
+    if (_co_blocking_submit(call) < 0) {
+        // no helper to be had, better block the thread than fail
+        atomic_store(&self->parked, 0);
+        free(call);
+        return fn(arg);
+    }
+    _co_park(meta);
+    long ret = call->ret;
+    int err = call->err;
+    free(call);
+    errno = err;
+    return ret;
+}
+
+int co_set_blocking_threads(int n) {
+    if (n <= 0) return -1;
+    pthread_mutex_lock(&_co_blocking_lock);
+    _co_blocking_max = n;
+    // surplus helpers waiting for calls exit now, busy ones after their call
+    pthread_cond_broadcast(&_co_blocking_cond);
+    pthread_mutex_unlock(&_co_blocking_lock);
+    return 0;
+}
+
+int co_blocking_stats(co_blocking_stats_t *stats) {
+    pthread_mutex_lock(&_co_blocking_lock);
+    stats->threads = _co_blocking_threads;
+    stats->busy = _co_blocking_busy;
+    stats->queued = _co_blocking_queued;
+    pthread_mutex_unlock(&_co_blocking_lock);
+    return 0;
+}
+
+/* Implementation of Timers */
+
+// Each thread keeps a binary min-heap of timers ordered by deadline, 
+// consulted whenever it looks for the next routine to run. A timer lives 
+// in the control block of the routine that armed it, and wakes it up by 
+// unparking, thus a routine also waiting on something else (co_wait_timeout)
+// is resumed by whichever comes first, and cancels the timer then.
+
+// take the timer at idx out of the heap of meta, under timer_lock
+static void _co_timer_remove(co_meta_t *meta, int idx) {
+    int n = atomic_load_explicit(&meta->ntimers, memory_order_relaxed);
+    co_heap_remove(meta->timers, n, idx);
+    atomic_store_explicit(&meta->ntimers, n - 1, memory_order_relaxed);
+}
+
+static int _co_timer_add(co_meta_t *meta, co_timer_t *timer) {
+    co_spin_lock(&meta->timer_lock);
+    int n = atomic_load_explicit(&meta->ntimers, memory_order_relaxed);
+    if (n == meta->timers_cap) {
+        int cap = meta->timers_cap? meta->timers_cap * 2: 16;
+        co_timer_t **heap = (co_timer_t **) 
+            realloc(meta->timers, sizeof(co_timer_t *) * cap);
+        if (heap == NULL) {
+            co_spin_unlock(&meta->timer_lock);
+            return -1;
+        }
+        meta->timers = heap, meta->timers_cap = cap;
+    }
+    timer->meta = meta;
+    meta->timers[n] = timer;
+    atomic_store_explicit(&meta->ntimers, n + 1, memory_order_relaxed);
+    co_heap_sift_up(meta->timers, n);
+    co_spin_unlock(&meta->timer_lock);
+    return 0;
+}
+
+// from any thread, once the routine that armed it is resumed
+static void _co_timer_cancel(co_timer_t *timer) {
+    co_meta_t *meta = timer->meta;
+    co_spin_lock(&meta->timer_lock);
+    if (timer->idx >= 0) _co_timer_remove(meta, timer->idx);
+    co_spin_unlock(&meta->timer_lock);
+}
+
+// wake up the routines whose timers have expired
+static void _co_timers_fire(co_meta_t *meta) {
+    long long now = _co_now();
+    co_spin_lock(&meta->timer_lock);
+    while (atomic_load_explicit(&meta->ntimers, memory_order_relaxed) > 0 &&
+           meta->timers[0]->deadline <= now) {
+        co_struct_t *coro = meta->timers[0]->coro;
+        _co_timer_remove(meta, 0);
+        _co_unpark(coro);
+    }
+    co_spin_unlock(&meta->timer_lock);
+}
+
+// whether an idle thread has something to do after all: wake-ups from 
+// other threads, or for a pool worker, work to steal or the pool stopping
+static int _co_idle_pending(co_meta_t *meta) {
+    if (atomic_load(&meta->inbox) != NULL) return 1;
+    return meta->pool != NULL && _co_worker_pending(meta);
+}
+
+// Block in the kernel till the next timer, one of the fds of the thread 
+// gets ready or another thread hands it something (see _co_idle_wake). 
+// The thread announces how it blocks before its last look around, thus a 
+// waker either gets seen then or sees it idle and wakes it, in one system 
+// call; no thread polls while there is nothing to do.
+static void _co_idle(co_meta_t *meta) {
+    long long wait = -1;
+    co_spin_lock(&meta->timer_lock);
+    if (atomic_load_explicit(&meta->ntimers, memory_order_relaxed) > 0) {
+        wait = meta->timers[0]->deadline - _co_now();
+        if (wait <= 0) wait = 0;
+    }
+    co_spin_unlock(&meta->timer_lock);
+    if (wait == 0) return;
+    int polling = atomic_load_explicit(&meta->nio, memory_order_relaxed) > 0;
+    atomic_store(&meta->idle, polling? CO_IDLE_EPOLL: CO_IDLE_FUTEX);
+    if (!_co_idle_pending(meta)) {
+        if (polling) {
+            _co_netpoll(meta, wait < 0? -1: (int) ((wait + 999999) / 1000000));
+        } else {
+            struct timespec ts = { wait / 1000000000, wait % 1000000000 };
+            syscall(SYS_futex, &meta->idle, FUTEX_WAIT_PRIVATE, CO_IDLE_FUTEX,
+                    wait < 0? NULL: &ts, NULL, 0);
+        }
+    }
+    atomic_store_explicit(&meta->idle, CO_IDLE_RUNNING, memory_order_relaxed);
+    // the routine about to park isn't charged for the time nobody ran
+    long long now = _co_prof_clock();
+    if (now != 0) meta->prof_since = now;
+}
+
+// wake a thread up from _co_idle, 
+// returns whether it was blocked (or about to block) there
+static int _co_idle_wake(co_meta_t *meta) {
+    if (atomic_load_explicit(&meta->idle, memory_order_relaxed) == 
+        CO_IDLE_RUNNING) return 0;
+    int idle = atomic_exchange(&meta->idle, CO_IDLE_RUNNING);
+    if (idle == CO_IDLE_FUTEX) 
+        syscall(SYS_futex, &meta->idle, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    else if (idle == CO_IDLE_EPOLL) 
+        eventfd_write(meta->evfd, 1);
+    return idle != CO_IDLE_RUNNING;
+}
+
+int co_sleep(long long ns) {
+    co_meta_t *meta = _co_getmeta();
+    CO_NOPREEMPT(meta);
+    if (ns <= 0) return co_yield();
+    co_struct_t *self = meta->running;
+    co_timer_t *timer = &self->timer;
+    timer->deadline = _co_now() + ns;
+    timer->coro = self;
+    atomic_store(&self->parked, 1);
+    if (_co_timer_add(meta, timer) < 0) {
+        atomic_store(&self->parked, 0);
+        return -1;
+    }
+    _co_park(meta);
+    _co_timer_cancel(timer);
+    return 0;
+}
+
+int co_wait_timeout(int cid, long long ns) {
+    co_meta_t *meta = _co_getmeta();
+    CO_NOPREEMPT(meta);
+    co_struct_t *qcoro = _co_lookup(cid);
+    if (qcoro == NULL) return -1;
+    co_struct_t *self = meta->running;
+    co_timer_t *timer = &self->timer;
+    self->waiter.coro = self;
+    timer->deadline = _co_now() + ns;
+    timer->coro = self;
+
+    atomic_store(&self->parked, 1);
+    co_spin_lock(&qcoro->wait_lock);
+    // status is only set to FINISHED under wait_lock
+    if (_co_status(qcoro) == FINISHED) {
+        co_spin_unlock(&qcoro->wait_lock);
+        atomic_store(&self->parked, 0);
+        return 0;
+    }
+    if (ns <= 0 || _co_timer_add(meta, timer) < 0) {
+        co_spin_unlock(&qcoro->wait_lock);
+        atomic_store(&self->parked, 0);
+        return TIMEDOUT;
+    }
+    co_waiter_link(&qcoro->waiters, &self->waiter);
+    co_spin_unlock(&qcoro->wait_lock);
+    long long start = _co_prof_clock();
+    _co_park(meta);
+    if (start != 0) self->wait_ns += _co_now() - start;
+
+    // woken up by either of them, withdraw from the other
+    _co_timer_cancel(timer);
+    co_spin_lock(&qcoro->wait_lock);
+    int finished = _co_status(qcoro) == FINISHED;
+    // the waiter list is emptied when it finishes
+    if (!finished) co_waiter_unlink(&qcoro->waiters, &self->waiter);
+    co_spin_unlock(&qcoro->wait_lock);
+    return finished? 0: TIMEDOUT;
+}
+
+/* Implementation of Preemption */
+
+// A thread that turns preemption on gets a timer on its own CPU time, 
+// ticking every slice with CO_PREEMPT_SIGNAL directed at it. A tick that 
+// finds the thread hasn't switched since the previous one preempts the 
+// running routine right from the handler, which runs on the routine's 
+// stack: co_yield suspends it there as if it were a call, and the 
+// handler returns once it is resumed, and the kernel restores everything 
+// else it had interrupted. That is only safe where the interrupted code 
+// could have called co_yield itself, thus a tick gives up, and leaves a 
+// note for co_preempt_enable, if the routine is in a critical section 
+// (library calls included, see CO_NOPREEMPT) or the interrupted code is 
+// not the executable's own, e.g. inside malloc holding its lock. Pool 
+// workers are never preempted: a routine could resume on another worker 
+// with the address of a thread-local variable of the first in a register.
+
+#ifdef CO_CTX_ASM
+
+#define CO_PREEMPT_SIGNAL (SIGURG)
+    // ignored by default, a stray tick after a timer is gone is harmless
+
+static pthread_once_t _co_preempt_once = PTHREAD_ONCE_INIT;
+static int _co_preempt_ok;
+static uintptr_t _co_text_lo, _co_text_hi;
+    // the executable's own code, where routines may be preempted
+
+static void _co_preempt_handler(int sig, siginfo_t *info, void *uctx) {
+    co_meta_t *meta = _co_self;
+    if (meta == NULL || meta->pool != NULL) return;
+    // the running routine has only been running for a whole slice 
+    // if the thread hasn't switched since the previous tick
+    if (meta->switches != meta->preempt_mark) {
+        meta->preempt_mark = meta->switches;
+        meta->preempt_pending = 0;
+        return;
+    }
+    co_struct_t *self = meta->running;
+    uintptr_t pc = ((ucontext_t *) uctx)->uc_mcontext.gregs[REG_RIP];
+    if (self->nopreempt > 0 || pc < _co_text_lo || pc >= _co_text_hi) {
+        meta->preempt_pending = 1;
+        return;
+    }
+    int saved_errno = errno;
+    // a nested tick (the signal isn't blocked in here) leaves it alone
+    self->nopreempt++;
+    co_yield();
+    self->nopreempt--;
+    errno = saved_errno;
+}
+
+// the first loaded object is the executable itself
+static int _co_text_find(struct dl_phdr_info *info, size_t size, void *data) {
+    for (int i = 0; i < info->dlpi_phnum; ++i) {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type != PT_LOAD || !(phdr->p_flags & PF_X)) continue;
+        _co_text_lo = info->dlpi_addr + phdr->p_vaddr;
+        _co_text_hi = _co_text_lo + phdr->p_memsz;
+    }
+    return 1;
+}
+
+static void _co_preempt_setup() {
+    dl_iterate_phdr(_co_text_find, NULL);
+    // the handler may switch away for long, during which the thread 
+    // has to take further ticks
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = _co_preempt_handler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    _co_preempt_ok = _co_text_hi > _co_text_lo && 
+                     sigaction(CO_PREEMPT_SIGNAL, &action, NULL) == 0;
+}
+
+#endif
+
+int co_set_preempt(long long slice_ns) {
+#ifdef CO_CTX_ASM
+    co_meta_t *meta = _co_getmeta();
+    CO_NOPREEMPT(meta);
+    if (meta->pool != NULL) return -1;
+    pthread_once(&_co_preempt_once, _co_preempt_setup);
+    if (!_co_preempt_ok) return -1;
+    if (slice_ns < 0) slice_ns = 0;
+    if (!meta->preempt_armed) {
+        if (slice_ns == 0) return 0;
+        struct sigevent event;
+        memset(&event, 0, sizeof(event));
+        event.sigev_notify = SIGEV_THREAD_ID;
+        event.sigev_signo = CO_PREEMPT_SIGNAL;
+        // sigev_notify_thread_id, which older glibc headers lack
+        event._sigev_un._tid = gettid();
+        if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, 
+                         &meta->preempt_timer) < 0) return -1;
+        meta->preempt_armed = 1;
+    }
+    struct timespec slice = { slice_ns / 1000000000, slice_ns % 1000000000 };
+    struct itimerspec spec = { slice, slice };
+    return timer_settime(meta->preempt_timer, 0, &spec, NULL);
+#else
+    // the handler needs the interrupted pc, and a switch that leaves 
+    // the signal mask alone
+    return -1;
+#endif
+}
+
+int co_preempt_disable() {
+    _co_preempt_off(_co_getmeta());
+    return 0;
+}
+
+int co_preempt_enable() {
+    co_meta_t *meta = _co_getmeta();
+    co_struct_t *self = meta->running;
+    _co_preempt_on(&self);
+    // the slice ran out meanwhile
+    if (self->nopreempt == 0 && meta->preempt_pending) {
+        meta->preempt_pending = 0;
+        co_yield();
+    }
+    return 0;
+}
+
+/* Implementation of Profiler */
+
+// While the profiler is on, a timer on the CPU time of the whole process 
+// (ITIMER_PROF) sends SIGPROF to whichever thread is running, and the 
+// handler records the cid and entry of its running routine along with a 
+// backtrace of the interrupted code into a ring of that thread. A ring 
+// has a single producer (the handler) and a single consumer (co_prof_dump,
+// dumps are serialized), thus neither side takes a lock, and a full ring 
+// drops samples. Rings are never freed: one whose thread has exited is 
+// taken over by the next thread that needs one. Backtraces stop at the 
+// bottom of a routine's stack (see _co_ctx_entry), a sample only shows 
+// the frames of the routine it was taken in.
+
+#define CO_PROF_DEPTH (16)
+    // frames kept per sample, innermost first
+#define CO_PROF_RING (4096)
+    // samples a thread buffers till the next dump
+
+typedef struct co_prof_sample_t {
+    int cid;
+    int depth;
+    void *entry;
+        // the routine it was taken in, NULL for the main routine
+    void *pc[CO_PROF_DEPTH];
+} co_prof_sample_t;
+
+struct co_prof_ring_t {
+    co_prof_ring_t *next;
+        // link in the list of all rings, which is only pushed to
+    _Atomic int busy;
+        // set while a thread records into it
+    _Atomic unsigned long head;
+    _Atomic unsigned long tail;
+        // samples [tail, head) are recorded but not dumped yet
+    _Atomic unsigned long dropped;
+    co_prof_sample_t samples[CO_PROF_RING];
+};
+
+static _Atomic(co_prof_ring_t *) _co_prof_rings;
+static pthread_mutex_t _co_prof_lock = PTHREAD_MUTEX_INITIALIZER;
+    // serializes co_prof_start, co_prof_stop and co_prof_dump
+static pthread_once_t _co_prof_once = PTHREAD_ONCE_INIT;
+static int _co_prof_ok;
+
+// charge the suspended routine for its turn, called on every switch 
+// while the profiler is on
+static __attribute__((noinline)) 
+void _co_prof_switch(co_meta_t *meta, co_struct_t *prev, co_struct_t *next) {
+    long long now = _co_now();
+    unsigned int epoch = 
+        atomic_load_explicit(&_co_prof_epoch, memory_order_relaxed);
+    if (meta->prof_epoch == epoch) prev->run_ns += now - meta->prof_since;
+    meta->prof_epoch = epoch;
+    meta->prof_since = now;
+    next->nswitch++;
+}
+
+// ring of the calling thread, taken over or created on its first sample
+static co_prof_ring_t *_co_prof_ring(co_meta_t *meta) {
+    if (meta->prof_ring != NULL) return meta->prof_ring;
+    co_prof_ring_t *ring = atomic_load(&_co_prof_rings);
+    for (; ring != NULL; ring = ring->next) {
+        int busy = 0;
+        if (atomic_compare_exchange_strong(&ring->busy, &busy, 1)) break;
+    }
+    if (ring == NULL) {
+        // unlike malloc, mmap may be called from a signal handler
+        ring = (co_prof_ring_t *) mmap(NULL, sizeof(co_prof_ring_t), 
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED) return NULL;
+        ring->busy = 1;
+        co_prof_ring_t *head = atomic_load(&_co_prof_rings);
+        do ring->next = head;
+        while (!atomic_compare_exchange_weak(&_co_prof_rings, &head, ring));
+    }
+    return meta->prof_ring = ring;
+}
+
+static void _co_prof_detach(co_meta_t *meta) {
+    if (meta->prof_ring != NULL) atomic_store(&meta->prof_ring->busy, 0);
+}
+
+static void _co_prof_handler(int sig, siginfo_t *info, void *uctx) {
+    co_meta_t *meta = _co_self;
+    if (meta == NULL) return;
+    int saved_errno = errno;
+    co_prof_ring_t *ring = _co_prof_ring(meta);
+    if (ring == NULL) goto out;
+    unsigned long head = 
+        atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == 
+        CO_PROF_RING) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        goto out;
+    }
+    co_prof_sample_t *sample = &ring->samples[head % CO_PROF_RING];
+    co_struct_t *self = meta->running;
+    sample->cid = self->cid;
+    sample->entry = _co_entry(self);
+    // the handler's own frame and the signal trampoline come first, 
+    // the interrupted code starts at the pc it was interrupted at
+    void *frames[CO_PROF_DEPTH + 2];
+    int n = backtrace(frames, CO_PROF_DEPTH + 2), skip = 2;
+#if defined(__x86_64__)
+    void *pc = (void *) ((ucontext_t *) uctx)->uc_mcontext.gregs[REG_RIP];
+    for (int i = 0; i < n; ++i) 
+        if (frames[i] == pc) { skip = i; break; }
+#endif
+#ifdef CO_CTX_ASM
+    // a routine's stack starts with _co_ctx_entry and the entry function 
+    // of its kind (e.g. _co_func_entry), its entry is shown instead
+    if (n - skip >= 2 && frames[n - 1] == (void *) _co_ctx_entry_ret) n -= 2;
+#endif
+    sample->depth = n > skip? n - skip: 0;
+    if (sample->depth > CO_PROF_DEPTH) sample->depth = CO_PROF_DEPTH;
+    memcpy(sample->pc, frames + skip, sample->depth * sizeof(void *));
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+out:
+    errno = saved_errno;
+}
+
+static void _co_prof_setup() {
+    // the first backtrace loads the unwinder, which mustn't happen 
+    // in a signal handler
+    void *frame;
+    backtrace(&frame, 1);
+    // the handler mustn't be preempted while it fills a sample in
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = _co_prof_handler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaddset(&action.sa_mask, SIGURG);
+    _co_prof_ok = sigaction(SIGPROF, &action, NULL) == 0;
+}
+
+int co_prof_start(long long period_ns) {
+    if (period_ns <= 0) return -1;
+    pthread_once(&_co_prof_once, _co_prof_setup);
+    if (!_co_prof_ok) return -1;
+    pthread_mutex_lock(&_co_prof_lock);
+    // turns are only counted from the next switch of each thread
+    atomic_fetch_add(&_co_prof_epoch, 1);
+    atomic_store(&_co_prof_on, 1);
+    long long us = period_ns < 1000? 1: period_ns / 1000;
+    struct timeval period = { us / 1000000, us % 1000000 };
+    struct itimerval spec = { period, period };
+    int ret = setitimer(ITIMER_PROF, &spec, NULL);
+    pthread_mutex_unlock(&_co_prof_lock);
+    return ret;
+}
+
+int co_prof_stop() {
+    pthread_mutex_lock(&_co_prof_lock);
+    struct itimerval spec;
+    memset(&spec, 0, sizeof(spec));
+    int ret = setitimer(ITIMER_PROF, &spec, NULL);
+    atomic_store(&_co_prof_on, 0);
+    pthread_mutex_unlock(&_co_prof_lock);
+    return ret;
+}
+
+static int _co_prof_cmp(const void *a, const void *b) {
+    const co_prof_sample_t *x = a, *y = b;
+    if (x->entry != y->entry) return x->entry < y->entry? -1: 1;
+    if (x->depth != y->depth) return x->depth - y->depth;
+    return memcmp(x->pc, y->pc, x->depth * sizeof(void *));
+}
+
+static int _co_prof_cmp_cid(const void *a, const void *b) {
+    const co_prof_sample_t *x = a, *y = b;
+    if (x->cid != y->cid) return x->cid < y->cid? -1: 1;
+    return _co_prof_cmp(a, b);
+}
+
+// start of the function at addr if it is exported, thus samples taken 
+// anywhere in a function look the same, otherwise addr itself
+static void *_co_prof_func(void *addr) {
+    Dl_info info;
+    if (dladdr(addr, &info) != 0 && info.dli_saddr != NULL) 
+        return info.dli_saddr;
+    return addr;
+}
+
+// name of the function at addr, or its object file and offset 
+// (for addr2line) when it isn't exported
+static void _co_prof_name(FILE *out, void *addr) {
+    Dl_info info;
+    if (dladdr(addr, &info) == 0) {
+        fprintf(out, "%p", addr);
+    } else if (info.dli_sname != NULL) {
+        fputs(info.dli_sname, out);
+    } else {
+        const char *file = strrchr(info.dli_fname, '/');
+        fprintf(out, "%s+%#lx", file != NULL? file + 1: info.dli_fname, 
+                (unsigned long) ((char *) addr - (char *) info.dli_fbase));
+    }
+}
+
+int co_prof_dump(int fd, int by_cid) {
+    pthread_mutex_lock(&_co_prof_lock);
+    // take every sample recorded so far
+    co_prof_sample_t *samples = NULL;
+    size_t n = 0, cap = 0;
+    for (co_prof_ring_t *ring = atomic_load(&_co_prof_rings); ring != NULL; 
+         ring = ring->next) {
+        unsigned long tail = 
+            atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        unsigned long head = 
+            atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (n + (head - tail) > cap) {
+            cap = 2 * cap + (head - tail);
+            co_prof_sample_t *grown = 
+                (co_prof_sample_t *) realloc(samples, cap * sizeof(*samples));
+            if (grown == NULL) break;
+            samples = grown;
+        }
+        for (; tail != head; ++tail) 
+            samples[n++] = ring->samples[tail % CO_PROF_RING];
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+    // return addresses point past their calls, the leaf is exact
+    for (size_t i = 0; i < n; ++i) {
+        void **pc = samples[i].pc;
+        for (int k = 0; k < samples[i].depth; ++k) 
+            pc[k] = _co_prof_func((char *) pc[k] - (k > 0));
+    }
+    // one line per distinct stack, root first, then its number of samples
+    qsort(samples, n, sizeof(*samples), by_cid? _co_prof_cmp_cid: _co_prof_cmp);
+    int dup_fd = dup(fd);
+    FILE *out = dup_fd >= 0? fdopen(dup_fd, "w"): NULL;
+    if (out == NULL) {
+        if (dup_fd >= 0) close(dup_fd);
+        free(samples);
+        pthread_mutex_unlock(&_co_prof_lock);
+        return -1;
+    }
+    for (size_t i = 0, j; i < n; i = j) {
+        int (*cmp)(const void *, const void *) = 
+            by_cid? _co_prof_cmp_cid: _co_prof_cmp;
+        for (j = i + 1; j < n && cmp(samples + i, samples + j) == 0; ++j);
+        co_prof_sample_t *sample = samples + i;
+        if (by_cid) fprintf(out, "cid %d;", sample->cid);
+        if (sample->entry != NULL) _co_prof_name(out, sample->entry);
+        else fputs("[main]", out);
+        for (int k = sample->depth - 1; k >= 0; --k) {
+            fputc(';', out);
+            _co_prof_name(out, sample->pc[k]);
+        }
+        fprintf(out, " %zu\n", j - i);
+    }
+    int ret = fclose(out) == 0? (int) n: -1;
+    free(samples);
+    pthread_mutex_unlock(&_co_prof_lock);
+    return ret;
+}
+
+int co_stats(int cid, co_stats_t *stats) {
+    co_meta_t *meta = _co_getmeta();
+    co_struct_t *qcoro = _co_lookup_self(meta, cid);
+    if (qcoro == NULL) return -1;
+    stats->switches = qcoro->nswitch;
+    stats->run_ns = qcoro->run_ns;
+    stats->wait_ns = qcoro->wait_ns;
+    // the running routine's current turn counts as well
+    long long now = _co_prof_clock();
+    if (qcoro == meta->running && now != 0 && 
+        meta->prof_epoch == atomic_load(&_co_prof_epoch))
+        stats->run_ns += now - meta->prof_since;
+    return 0;
+}
+
+/* Implementation of Channels */
+
+// A bounded FIFO of fixed-size elements under a spinlock, with queues of 
+// routines parked sending and receiving. A sender finding a receiver parked 
+// copies its element straight into the receiver's variable, and a receiver 
+// taking from a full buffer refills it from the first parked sender, so 
+// elements keep their order and never wait in a buffer while someone waits 
+// for them. A channel of capacity 0 has no buffer, every send meets a recv.
+
+struct co_chan_t {
+    co_spin_t lock;
+    int closed;
+    int cap;
+    size_t elem_size;
+    int head;
+    int count;
+    char *buf;
+        // ring buffer of cap elements, count of them from head on
+    co_waitq_t sendq;
+    co_waitq_t recvq;
+        // routines parked in co_send/co_recv, in arrival order
+};
+
+static inline char *co_chan_at(co_chan_t *chan, int idx) {
+    return chan->buf + (size_t) ((chan->head + idx) % chan->cap) * chan->elem_size;
+}
+
+// wake up a waiter taken off a queue, it must not be touched afterwards
+// as its routine may be parked on something else by then
+static inline void _co_chan_wake(co_waiter_t *waiter, int ok) {
+    co_struct_t *coro = waiter->coro;
+    waiter->ok = ok;
+    _co_unpark(coro);
+}
+
+// park the running routine in queue, called with chan->lock held;
+// an element on the shared stack is copied by others while another 
+// routine may be there, thus it goes through a buffer of its own
+static int _co_chan_park(co_chan_t *chan, co_waitq_t *queue, void *elem, 
+                         int sending) {
+    co_meta_t *meta = _co_getmeta();
+    co_struct_t *self = meta->running;
+    void *bounce = NULL;
+    if (__builtin_expect(_co_on_shared_stack(meta, elem), 0)) {
+        if ((bounce = malloc(chan->elem_size)) == NULL) {
+            co_spin_unlock(&chan->lock);
+            return -1;
+        }
+        if (sending) memcpy(bounce, elem, chan->elem_size);
+    }
+    self->waiter.coro = self;
+    self->waiter.elem = bounce != NULL? bounce: elem;
+    atomic_store(&self->parked, 1);
+    co_waitq_push(queue, &self->waiter);
+    co_spin_unlock(&chan->lock);
+    _co_park(meta);
+    int ok = self->waiter.ok;
+    if (bounce != NULL) {
+        if (!sending && ok) memcpy(elem, bounce, chan->elem_size);
+        free(bounce);
+    }
+    return ok? 0: -1;
+}
+
+co_chan_t *co_chan_create(int cap, size_t elem_size) {
+    if (cap < 0 || elem_size == 0) return NULL;
+    co_chan_t *chan = (co_chan_t *) calloc(1, sizeof(co_chan_t));
+    if (chan == NULL) return NULL;
+    chan->cap = cap;
+    chan->elem_size = elem_size;
+    if (cap > 0 && (chan->buf = (char *) malloc(cap * elem_size)) == NULL) {
+        free(chan);
+        return NULL;
+    }
+    return chan;
+}
+
+int co_send(co_chan_t *chan, const void *elem) {
+    CO_NOPREEMPT(_co_getmeta());
+    co_spin_lock(&chan->lock);
+    if (chan->closed) {
+        co_spin_unlock(&chan->lock);
+        return -1;
+    }
+    // the buffer is empty while anyone waits to receive
+    co_waiter_t *receiver = co_waitq_pop(&chan->recvq);
+    if (receiver != NULL) {
+        memcpy(receiver->elem, elem, chan->elem_size);
+        co_spin_unlock(&chan->lock);
+        _co_chan_wake(receiver, 1);
+        return 0;
+    }
+    if (chan->count < chan->cap) {
+        memcpy(co_chan_at(chan, chan->count++), elem, chan->elem_size);
+        co_spin_unlock(&chan->lock);
+        return 0;
+    }
+    return _co_chan_park(chan, &chan->sendq, (void *) elem, 1);
+}
+
+int co_recv(co_chan_t *chan, void *elem) {
+    CO_NOPREEMPT(_co_getmeta());
+    co_spin_lock(&chan->lock);
+    // the buffer is full while anyone waits to send
+    co_waiter_t *sender = co_waitq_pop(&chan->sendq);
+    if (chan->count > 0) {
+        memcpy(elem, co_chan_at(chan, 0), chan->elem_size);
+        chan->head = (chan->head + 1) % chan->cap;
+        chan->count--;
+        if (sender != NULL) 
+            memcpy(co_chan_at(chan, chan->count++), sender->elem, chan->elem_size);
+    } else if (sender != NULL) {
+        memcpy(elem, sender->elem, chan->elem_size);
+    } else if (chan->closed) {
+        co_spin_unlock(&chan->lock);
+        return -1;
+    } else {
+        return _co_chan_park(chan, &chan->recvq, elem, 0);
+    }
+    co_spin_unlock(&chan->lock);
+    if (sender != NULL) _co_chan_wake(sender, 1);
+    return 0;
+}
+
+int co_chan_close(co_chan_t *chan) {
+    CO_NOPREEMPT(_co_getmeta());
+    co_spin_lock(&chan->lock);
+    if (chan->closed) {
+        co_spin_unlock(&chan->lock);
+        return -1;
+    }
+    chan->closed = 1;
+    co_waiter_t *senders = chan->sendq.head, *receivers = chan->recvq.head;
+    chan->sendq.head = chan->sendq.tail = NULL;
+    chan->recvq.head = chan->recvq.tail = NULL;
+    co_spin_unlock(&chan->lock);
+    // the links are read before each waiter is woken
+    for (co_waiter_t *next; senders != NULL; senders = next) {
+        next = senders->next;
+        _co_chan_wake(senders, 0);
+    }
+    for (co_waiter_t *next; receivers != NULL; receivers = next) {
+        next = receivers->next;
+        _co_chan_wake(receivers, 0);
+    }
+    return 0;
+}
+
+void co_chan_destroy(co_chan_t *chan) {
+    if (chan == NULL) return;
+    free(chan->buf);
+    free(chan);
+}
+
+/* Implementation of Synchronization */
+
+// Routines parked on a mutex, condition variable or semaphore wait in a 
+// FIFO of their waiters, guarded by a spinlock of the primitive.
+// The mutex follows the classic three-state futex design: only unlocking 
+// a mutex marked contended (2) looks at the queue, and a woken routine 
+// competes for the mutex again, marking it contended for its own unlock.
+// The semaphore count goes negative by the number of waiters, so post 
+// only takes the lock when someone waits (or is about to).
+
+// queue the running routine and park it once lock is released
+static void _co_waitq_park(co_waitq_t *queue, co_spin_t *lock) {
+    co_meta_t *meta = _co_getmeta();
+    co_struct_t *self = meta->running;
+    self->waiter.coro = self;
+    atomic_store(&self->parked, 1);
+    co_waitq_push(queue, &self->waiter);
+    co_spin_unlock(lock);
+    _co_park(meta);
+}
+
+// wake up the first routine in queue, if any
+static int _co_waitq_wake(co_waitq_t *queue, co_spin_t *lock) {
+    CO_NOPREEMPT(_co_getmeta());
+    co_spin_lock(lock);
+    co_waiter_t *waiter = co_waitq_pop(queue);
+    // read before unlocking, the waiter may be woken up by no one else
+    co_struct_t *coro = waiter != NULL? waiter->coro: NULL;
+    co_spin_unlock(lock);
+    if (coro != NULL) _co_unpark(coro);
+    return coro != NULL;
+}
+
+int co_mutex_init(co_mutex_t *mutex) {
+    memset(mutex, 0, sizeof(co_mutex_t));
+    return 0;
+}
+
+int co_mutex_trylock(co_mutex_t *mutex) {
+    int expected = 0;
+    return atomic_compare_exchange_strong(&mutex->state, &expected, 1)? 0: -1;
+}
+
+int co_mutex_lock(co_mutex_t *mutex) {
+    int expected = 0;
+    if (atomic_compare_exchange_strong(&mutex->state, &expected, 1)) return 0;
+    CO_NOPREEMPT(_co_getmeta());
+    for (;;) {
+        co_spin_lock(&mutex->lock);
+        // an unlock racing with this sees the state 2 and the waiter queued
+        if (atomic_exchange(&mutex->state, 2) == 0) {
+            co_spin_unlock(&mutex->lock);
+            return 0;
+        }
+        _co_waitq_park(&mutex->waiters, &mutex->lock);
+    }
+}
+
+int co_mutex_unlock(co_mutex_t *mutex) {
+    if (atomic_exchange(&mutex->state, 0) == 2) 
+        _co_waitq_wake(&mutex->waiters, &mutex->lock);
+    return 0;
+}
+
+int co_cond_init(co_cond_t *cond) {
+    memset(cond, 0, sizeof(co_cond_t));
+    return 0;
+}
+
+int co_cond_wait(co_cond_t *cond, co_mutex_t *mutex) {
+    co_meta_t *meta = _co_getmeta();
+    CO_NOPREEMPT(meta);
+    co_struct_t *self = meta->running;
+    self->waiter.coro = self;
+    atomic_store(&self->parked, 1);
+    co_spin_lock(&cond->lock);
+    co_waitq_push(&cond->waiters, &self->waiter);
+    co_spin_unlock(&cond->lock);
+    // a signal between unlocking and parking only clears parked
+    co_mutex_unlock(mutex);
+    _co_park(meta);
+    return co_mutex_lock(mutex);
+}
+
+int co_cond_signal(co_cond_t *cond) {
+    _co_waitq_wake(&cond->waiters, &cond->lock);
+    return 0;
+}
+
+int co_cond_broadcast(co_cond_t *cond) {
+    CO_NOPREEMPT(_co_getmeta());
+    co_spin_lock(&cond->lock);
+    co_waiter_t *waiters = cond->waiters.head;
+    cond->waiters.head = cond->waiters.tail = NULL;
+    co_spin_unlock(&cond->lock);
+    for (co_waiter_t *next; waiters != NULL; waiters = next) {
+        next = waiters->next;
+        _co_unpark(waiters->coro);
+    }
+    return 0;
+}
+
+int co_sem_init(co_sem_t *sem, int value) {
+    if (value < 0) return -1;
+    memset(sem, 0, sizeof(co_sem_t));
+    atomic_store(&sem->count, value);
+    return 0;
+}
+
+int co_sem_wait(co_sem_t *sem) {
+    if (atomic_fetch_sub(&sem->count, 1) > 0) return 0;
+    CO_NOPREEMPT(_co_getmeta());
+    co_spin_lock(&sem->lock);
+    // a post may have come in between, its unit is left in pending
+    if (sem->pending > 0) {
+        sem->pending--;
+        co_spin_unlock(&sem->lock);
+        return 0;
+    }
+    _co_waitq_park(&sem->waiters, &sem->lock);
+    return 0;
+}
+
+int co_sem_post(co_sem_t *sem) {
+    if (atomic_fetch_add(&sem->count, 1) >= 0) return 0;
+    // someone waits or is about to, hand the unit over to it
+    CO_NOPREEMPT(_co_getmeta());
+    co_spin_lock(&sem->lock);
+    co_waiter_t *waiter = co_waitq_pop(&sem->waiters);
+    co_struct_t *coro = waiter != NULL? waiter->coro: NULL;
+    if (coro == NULL) sem->pending++;
+    co_spin_unlock(&sem->lock);
+    if (coro != NULL) _co_unpark(coro);
+    return 0;
+}
+
+/* Implementation of Worker Pool (M:N mode) */
+
+// A fixed pool of worker threads, each running routines from its own 
+// local run queue, and stealing runnable ones from the head of other 
+// workers' queues when its own runs dry. Routines of a pool are not 
+// bound to any thread, and a routine started by co_start leaves its 
+// parent at the head of the local queue, so that idle workers steal 
+// the continuation of a spawning routine first.
+
+struct co_pool_t {
+    int nworkers;
+    co_meta_t **workers;
+    pthread_t *threads;
+        // worker threads and their meta information
+    co_func_t root;
+    int root_cid;
+        // the routine started by co_pool_run
+    _Atomic int live;
+        // number of unfinished routines in the pool
+    _Atomic int stop;
+        // set once live drops to zero, workers exit then
+    _Atomic int sleeping;
+        // number of workers blocked in _co_idle until work is queued
+    pthread_barrier_t barrier;
+        // no worker steals before all have registered, 
+        // and no one exits while others may still steal from it
+};
+
+typedef struct co_worker_arg_t {
+    co_pool_t *pool;
+    int id;
+} co_worker_arg_t;
+
+// wake up one sleeping worker, if any, to steal what was just queued
+static void _co_pool_notify(co_pool_t *pool) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&pool->sleeping, memory_order_relaxed) == 0) 
+        return;
+    for (int i = 0; i < pool->nworkers; ++i)
+        if (_co_idle_wake(pool->workers[i])) return;
+}
+
+static void _co_pool_spawn(co_pool_t *pool, int n) {
+    atomic_fetch_add(&pool->live, n);
+}
+
+static void _co_pool_finish(co_pool_t *pool, int n) {
+    if (atomic_fetch_sub(&pool->live, n) == n) {
+        atomic_store(&pool->stop, 1);
+        for (int i = 0; i < pool->nworkers; ++i) 
+            _co_idle_wake(pool->workers[i]);
+    }
+}
+
+// _co_group_unqueue over the ready queues of every worker
+static int _co_pool_unqueue(co_pool_t *pool, co_group_t *group) {
+    int n = 0;
+    for (int i = 0; i < pool->nworkers; ++i) {
+        co_meta_t *worker = pool->workers[i];
+        co_spin_lock(&worker->ready_lock);
+        n += _co_group_unqueue(worker, group);
+        co_spin_unlock(&worker->ready_lock);
+    }
+    return n;
+}
+
+static co_struct_t *_co_steal(co_meta_t *meta) {
+    co_pool_t *pool = meta->pool;
+    int start = rand_r(&meta->seed) % pool->nworkers;
+    for (int i = 0; i < pool->nworkers; ++i) {
+        co_meta_t *victim = pool->workers[(start + i) % pool->nworkers];
+        if (victim == meta) continue;
+        co_struct_t *coro = _co_ready_pop(victim);
+        if (coro != NULL) return coro;
+    }
+    return NULL;
+}
+
+// whether an idle worker has work to steal after all, or should exit
+static int _co_worker_pending(co_meta_t *meta) {
+    co_pool_t *pool = meta->pool;
+    if (atomic_load(&pool->stop)) return 1;
+    for (int i = 0; i < pool->nworkers; ++i) {
+        co_meta_t *victim = pool->workers[i];
+        if (__atomic_load_n(&victim->ready_mask, __ATOMIC_SEQ_CST) != 0 ||
+            __atomic_load_n(&victim->ready[CO_CLASS_NORMAL].head, 
+                            __ATOMIC_SEQ_CST) != NULL) return 1;
+    }
+    return 0;
+}
+
+// sleeping is counted before the worker announces itself idle, thus a 
+// notifier that misses the count queued its work before the last steal
+static void _co_worker_sleep(co_meta_t *meta) {
+    atomic_fetch_add(&meta->pool->sleeping, 1);
+    _co_idle(meta);
+    atomic_fetch_sub(&meta->pool->sleeping, 1);
+}
+
+static void *_co_worker(void *ptr) {
+    co_worker_arg_t *arg = (co_worker_arg_t *) ptr;
+    co_pool_t *pool = arg->pool;
+    co_meta_t *meta = _co_getmeta();
+    meta->pool = pool;
+    meta->seed = arg->id;
+    pool->workers[arg->id] = meta;
+    pthread_barrier_wait(&pool->barrier);
+
+    if (arg->id == 0) {
+        pool->root_cid = co_start(pool->root);
+        _co_pool_finish(pool, 1);
+    }
+
+    // scheduling loop, it is the main routine of the worker
+    int idle = 0;
+    while (!atomic_load_explicit(&pool->stop, memory_order_acquire)) {
+        // wake-ups from outside the pool land in the inbox
+        _co_poll(meta);
+        co_struct_t *coro = _co_ready_pop(meta);
+        if (coro == NULL) coro = _co_steal(meta);
+        if (coro != NULL && coro->lazy && _co_materialize(meta, coro) < 0) 
+            continue;
+        if (coro != NULL) {
+            idle = 0;
+            _co_switch(meta, coro, REQUEUE_NONE);
+        }
+        else if (atomic_load_explicit(&meta->nio, memory_order_relaxed) > 0 &&
+                 _co_netpoll(meta, 0) > 0) idle = 0;
+        else if (++idle < CO_IDLE_SPINS) sched_yield();
+        else _co_worker_sleep(meta);
+    }
+    pthread_barrier_wait(&pool->barrier);
+    return NULL;
+}
+
+int co_pool_run(int nworkers, co_func_t routine) {
+    if (nworkers <= 0) nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers <= 0) nworkers = 1;
+
+    co_pool_t *pool = (co_pool_t *) calloc(1, sizeof(co_pool_t));
+    pool->nworkers = nworkers;
+    pool->workers = (co_meta_t **) calloc(nworkers, sizeof(co_meta_t *));
+    pool->threads = (pthread_t *) calloc(nworkers, sizeof(pthread_t));
+    pool->root = routine;
+    pool->root_cid = -1;
+    pthread_barrier_init(&pool->barrier, NULL, nworkers);
+    // the root routine keeps the pool alive until it is started
+    atomic_store(&pool->live, 1);
+
+    co_worker_arg_t *args = 
+        (co_worker_arg_t *) malloc(sizeof(co_worker_arg_t) * nworkers);
+    for (int i = 0; i < nworkers; ++i) {
+        args[i].pool = pool, args[i].id = i;
+        pthread_create(pool->threads + i, NULL, _co_worker, args + i);
+    }
+    // worker 0 has started the root routine before anyone can finish it
+    for (int i = 0; i < nworkers; ++i) pthread_join(pool->threads[i], NULL);
+
+    int ret = -1;
+    if (pool->root_cid >= 0) {
+        ret = co_getret(pool->root_cid);
+        co_release(pool->root_cid);
+    }
+    pthread_barrier_destroy(&pool->barrier);
+    free(args), free(pool->threads), free(pool->workers), free(pool);
+    return ret;
+}
@@ -10,6 +10,9 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/types.h>
 #include <ucontext.h>
 
 #undef _GNU_SOURCE
@@ -17,17 +20,280 @@
 #undef _XOPEN_SOURCE
 
 typedef long long cid_t;
-#define MAXN (50000)
+#define MAXN (1 << 20) // max number of routines alive (i.e. not released)
 #define UNAUTHORIZED (-1)
 #define FINISHED (2)
 #define RUNNING (1)
+#define TIMEDOUT (-2)
+#define CANCELLED (-3)
+#define DEFAULT_STACK_SIZE (64 * 1024)
 
+// -1 once MAXN routines are alive, i.e. started and not yet co_release'd
 int co_start(int (*routine)(void));
 int co_getid();
 int co_getret(int cid);
 int co_yield();
 int co_waitall();
+// join the first of n routines to finish, storing its index in cids in 
+// *which (if not NULL; the lowest finished one if several have by the time
+// the caller runs again); or all n of them. The caller parks once and is 
+// woken once; -1 if any cid is invalid
+int co_wait_any(cid_t *cids, int n, int *which);
+int co_wait_all_of(cid_t *cids, int n);
 int co_wait(int cid);
 int co_status(int cid);
+// reap a routine, at once if it has finished, otherwise as soon as it 
+// finishes; its cid becomes invalid, and its slot and memory are reused
+int co_release(int cid);
+
+// lazy creation: routine(arg) is only queued behind the runnable routines,
+// and gets its stack and context once it is first picked to run (by any
+// worker in M:N mode), the caller goes on at once; -1 on failure. One that
+// can't get a stack then finishes at once with the return value -1.
+int co_spawn(int (*routine)(void *), void *arg);
+// co_spawn n routines at once, with args[i] (or NULL if args is NULL) as
+// arguments, counting and queueing them in one go; their cids are stored
+// in cids, or they are released right away if cids is NULL.
+// Returns the number of routines spawned.
+int co_spawn_n(int (*routine)(void *), void **args, int n, cid_t *cids);
+
+// task groups: co_group_spawn co_spawns routine(arg) as a member of group,
+// released right away (-1 on failure). co_group_join parks the caller
+// till every member has finished, and returns how many of them never ran
+// because of co_group_cancel: once a group is cancelled for good, members
+// that haven't started finish with CANCELLED instead of running, and those
+// already running find co_cancelled() set. The library never frees a
+// group: its creator must call co_group_destroy exactly once, when every
+// member has finished (a co_group_join returning ensures it, as does never
+// spawning into it) and every co_group_join on it has returned; the group
+// is freed then and may not be used again. Members spawned after a join 
+// need another join before the group is destroyed.
+typedef struct co_group_t co_group_t;
+co_group_t *co_group_create();
+int co_group_spawn(co_group_t *group, int (*routine)(void *), void *arg);
+// a batch of n members at once, as co_spawn_n does; returns how many
+int co_group_spawn_n(co_group_t *group, int (*routine)(void *), 
+                     void **args, int n);
+int co_group_join(co_group_t *group);
+int co_group_cancel(co_group_t *group);
+// whether the calling routine's group has been cancelled
+int co_cancelled();
+void co_group_destroy(co_group_t *group);
+
+// coroutine-local storage, like pthread keys but per routine (the main 
+// routine of each thread and generators have their own values too): 
+// co_key_create makes a key whose value is NULL in every routine, 
+// destructor (if any) is called on each non-NULL value when its routine 
+// returns; -1 once CO_KEYS_MAX keys exist. The first few keys are kept 
+// in the control block, lookups take no lock.
+typedef int co_key_t;
+#define CO_KEYS_MAX (1024)
+int co_key_create(co_key_t *key, void (*destructor)(void *));
+void *co_getspecific(co_key_t key);
+int co_setspecific(co_key_t key, const void *value);
+
+// stack size of routines started afterwards, rounded up to
+// a power-of-two number of pages; DEFAULT_STACK_SIZE by default
+int co_set_stack_size(size_t size);
+
+// stack tracking: in CO_STACK_TRACK mode, the stack of a routine started 
+// afterwards is measured when it finishes, and its high-water mark counts
+// towards the statistics of its entry routine; CO_STACK_ADAPT also gives 
+// later routines of an entry with enough marks a stack sized from the 
+// 99th percentile of them plus headroom (never more than co_set_stack_size
+// gives). A routine deeper than its kind has been so far may then hit the
+// guard page. Routines on the shared stack of copy-stack mode aren't 
+// measured.
+#define CO_STACK_FIXED (0)
+#define CO_STACK_TRACK (1)
+#define CO_STACK_ADAPT (2)
+int co_set_stack_mode(int mode);
+
+typedef struct co_stack_stats_t {
+    void *entry;
+        // the entry routine
+    long long count;
+        // routines measured
+    size_t max;
+    size_t avg;
+        // highest and average high-water mark in bytes
+    size_t size;
+        // stack size CO_STACK_ADAPT gives, 0 until enough are measured
+} co_stack_stats_t;
+// stores the statistics of up to n entry routines in stats, 
+// returns the number of entry routines measured so far
+int co_stack_stats(co_stack_stats_t *stats, int n);
+
+// scheduling classes: routines with a deadline run first, earliest 
+// first, then by priority, round robin within a priority; a class passed 
+// over for a while gets a turn, thus lower ones never starve. Routines 
+// inherit the priority of their creator (CO_PRIO_NORMAL for main), not the
+// deadline. Both take effect the next time the routine is queued; a 
+// routine, main included, names itself by co_getid().
+#define CO_PRIO_HIGH (-1)
+#define CO_PRIO_NORMAL (0)
+#define CO_PRIO_LOW (1)
+int co_setprio(int cid, int prio);
+// deadline ns nanoseconds from now, ns <= 0 clears it
+int co_setdeadline(int cid, long long ns);
+
+// copy-stack mode, for huge numbers of mostly idle routines: routines
+// started afterwards (outside worker pools) run on one stack of size bytes
+// per thread, and a suspended one only keeps its live stack depth in a
+// buffer of its own; 0 turns it off. A thread's shared stack keeps the
+// size it has when its first such routine starts. Pointers into the stack
+// of such a routine are only valid while it runs, except those handed to
+// this library. Returns -1 where unsupported (the ucontext backend).
+int co_set_shared_stack(size_t size);
+
+// preemption: a routine of the calling thread that runs for more than
+// slice_ns nanoseconds of CPU time without switching (one to two slices
+// in fact, and CPU time is counted at the kernel's tick, a few ms) is
+// suspended as if it had called co_yield; 0 turns it off.
+// Uses SIGURG, and returns -1 in worker pools and where unsupported (the
+// ucontext backend). Only code of the executable itself is preempted,
+// never library calls nor code in shared libraries (e.g. malloc); code
+// holding other locks, pthread ones say, should disable preemption.
+// co_preempt_disable/co_preempt_enable nest, and are per routine; the
+// latter yields if the slice ran out meanwhile.
+int co_set_preempt(long long slice_ns);
+int co_preempt_disable();
+int co_preempt_enable();
+
+// sampling profiler: every period_ns nanoseconds of CPU time used by the
+// process, the running thread records its running routine and a short 
+// backtrace (SIGPROF, thus system calls may fail with EINTR). co_prof_dump
+// writes the samples taken since the last dump as collapsed stacks, one 
+// "entry;frame;...;leaf count" line per distinct stack (prefixed with the 
+// cid if by_cid), for flame graph tools; returns the number of samples. 
+// Only functions exported to the dynamic symbol table are named (link 
+// with -rdynamic), others show as file+offset.
+int co_prof_start(long long period_ns);
+int co_prof_stop();
+int co_prof_dump(int fd, int by_cid);
+
+// per-routine counters, only kept while the profiler is on
+typedef struct co_stats_t {
+    long long switches;
+        // times it has been switched to
+    long long run_ns;
+        // time it has been running
+    long long wait_ns;
+        // time it has spent parked in co_wait, co_getret, co_wait_timeout
+} co_stats_t;
+int co_stats(int cid, co_stats_t *stats);
+
+// number of context switches made by the calling thread so far
+long long co_switch_count();
+
+// M:N mode: runs routine in a pool of nworkers threads (one per core 
+// if nworkers <= 0) that steal runnable routines from each other;
+// returns its return value once every routine in the pool has finished
+int co_pool_run(int nworkers, int (*routine)(void));
+
+// generators: func(arg) runs lazily on its own stack, every 
+// co_yield_value(v) in it hands v to co_gen_next, which returns 1 with 
+// *value = v, or 0 once func has returned; control passes directly between 
+// the two without the run queue. co_gen_destroy frees a generator that 
+// is done or suspended in co_yield_value (its stack is not unwound)
+typedef struct co_gen_t co_gen_t;
+co_gen_t *co_gen_start(int (*func)(void *), void *arg);
+int co_gen_next(co_gen_t *gen, long *value);
+int co_yield_value(long value);
+void co_gen_destroy(co_gen_t *gen);
+
+// I/O that parks the calling routine instead of blocking its thread, 
+// with the return values and errno of the system calls; fds are switched 
+// to non-blocking mode, and at most one routine reads and one writes an 
+// fd at a time (EBUSY otherwise). co_write only returns once everything 
+// is written (or on error). fds used with these are closed by co_close.
+ssize_t co_read(int fd, void *buf, size_t count);
+ssize_t co_write(int fd, const void *buf, size_t count);
+int co_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+int co_connect(int fd, const struct sockaddr *addr, socklen_t addrlen);
+int co_close(int fd);
+
+// blocking calls: co_blocking runs fn(arg) on a helper thread and parks the
+// calling routine meanwhile, the other routines of its thread keep running;
+// returns what fn returns, with errno as fn left it. At most 
+// co_set_blocking_threads helpers (CO_BLOCKING_THREADS by default) run at 
+// once, further calls queue up. fn must not call this library, and in 
+// copy-stack mode arg must not point into the caller's stack.
+#define CO_BLOCKING_THREADS (4)
+long co_blocking(long (*fn)(void *), void *arg);
+int co_set_blocking_threads(int n);
+
+typedef struct co_blocking_stats_t {
+    int threads;
+        // helper threads alive
+    int busy;
+        // helpers running a call
+    int queued;
+        // calls waiting for a helper
+} co_blocking_stats_t;
+int co_blocking_stats(co_blocking_stats_t *stats);
+
+// park the calling routine for ns nanoseconds, without using any CPU
+int co_sleep(long long ns);
+// co_wait for at most ns nanoseconds, returns TIMEDOUT if the routine 
+// hasn't finished by then
+int co_wait_timeout(int cid, long long ns);
+
+// bounded FIFO channels of cap elements of elem_size bytes each (cap may 
+// be 0, then every co_send waits for a co_recv); a full or empty channel 
+// parks the caller, and work across threads and worker pools
+typedef struct co_chan_t co_chan_t;
+co_chan_t *co_chan_create(int cap, size_t elem_size);
+// copy *elem into the channel, -1 if it is (or gets) closed
+int co_send(co_chan_t *chan, const void *elem);
+// copy the oldest element into *elem, -1 once it is closed and drained
+int co_recv(co_chan_t *chan, void *elem);
+// wake up everyone parked on it, elements buffered can still be received
+int co_chan_close(co_chan_t *chan);
+// free a channel nobody uses any more
+void co_chan_destroy(co_chan_t *chan);
+
+// mutex, condition variable and semaphore for routines: contention parks 
+// the calling routine only, and the thread runs others meanwhile; the 
+// uncontended paths take a single atomic operation. Usable across threads 
+// and worker pools, all-zero ones are valid (unlocked, and count 0).
+struct co_waiter_t;
+typedef struct co_waitq_t {
+    struct co_waiter_t *head;
+    struct co_waiter_t *tail;
+} co_waitq_t;
+
+typedef struct co_mutex_t {
+    _Atomic int state;
+        // 0 unlocked, 1 locked, 2 locked and maybe someone waiting
+    _Atomic int lock;
+    co_waitq_t waiters;
+} co_mutex_t;
+
+typedef struct co_cond_t {
+    _Atomic int lock;
+    co_waitq_t waiters;
+} co_cond_t;
+
+typedef struct co_sem_t {
+    _Atomic int count;
+        // available units minus the number of routines waiting
+    _Atomic int lock;
+    int pending;
+        // units posted to waiters that haven't queued yet
+    co_waitq_t waiters;
+} co_sem_t;
+
+int co_mutex_init(co_mutex_t *mutex);
+int co_mutex_lock(co_mutex_t *mutex);
+int co_mutex_trylock(co_mutex_t *mutex);
+int co_mutex_unlock(co_mutex_t *mutex);
+int co_cond_init(co_cond_t *cond);
+int co_cond_wait(co_cond_t *cond, co_mutex_t *mutex);
+int co_cond_signal(co_cond_t *cond);
+int co_cond_broadcast(co_cond_t *cond);
+int co_sem_init(co_sem_t *sem, int value);
+int co_sem_wait(co_sem_t *sem);
+int co_sem_post(co_sem_t *sem);
 
 #endif
@@ -1,10 +1,14 @@
 #include "coroutine.h"
 #include "utils.h"
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <string.h>
+#include <sys/socket.h>
 #include <sys/time.h>
+#include <time.h>
 
 cid_t getid_val = -1;
 
@@ -43,6 +47,680 @@ int test_getid(void){
     return getid_val;
 }
 
+int test_release() {
+    cid_t first = co_start(test_dummy);
+    if (co_release(first) != 0) fail("Release failed", __func__, __LINE__);
+    if (co_status(first) != UNAUTHORIZED) fail("Released coroutine still valid", __func__, __LINE__);
+    if (co_release(first) == 0) fail("Double release succeeded", __func__, __LINE__);
+    // far more coroutines than the old MAXN, only one alive at a time
+    for (int i = 0; i < 100000; ++i) {
+        cid_t cid = co_start(test_dummy);
+        if (cid < 0 || co_getret(cid) != 1) fail("Recycled coroutine failed", __func__, __LINE__);
+        co_release(cid);
+    }
+    return 0;
+}
+
+int io_fds[2];
+
+int test_io_echo() {
+    char buf[16];
+    ssize_t n = co_read(io_fds[1], buf, sizeof(buf));
+    if (n > 0) co_write(io_fds[1], buf, n);
+    return n;
+}
+
+// a routine of a short-lived thread parks on the fd; woken after delay_ms 
+// by the main thread if nonzero, by this thread at once otherwise
+void *test_io_thread(void *delay_ms) {
+    char c;
+    cid_t echo = co_start(test_io_echo);
+    if (delay_ms == NULL) write(io_fds[0], "x", 1);
+    long long ret = co_wait_timeout(echo, 1000000000LL) == 0? co_getret(echo): -1;
+    if (ret == 1) read(io_fds[0], &c, 1);
+    return (void *) ret;
+}
+
+int test_io() {
+    char buf[16] = {0};
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, io_fds) != 0) fail("Socketpair failed", __func__, __LINE__);
+    // the echo routine parks on the empty socket
+    cid_t echo = co_start(test_io_echo);
+    if (co_status(echo) == FINISHED) fail("Read did not park", __func__, __LINE__);
+    co_write(io_fds[0], "hello", 5);
+    if (co_read(io_fds[0], buf, sizeof(buf)) != 5 || strcmp(buf, "hello") != 0) fail("Echo failed", __func__, __LINE__);
+    if (co_getret(echo) != 5) fail("Echo return value failed", __func__, __LINE__);
+    // closing the fd wakes up a parked reader with an error
+    echo = co_start(test_io_echo);
+    co_close(io_fds[1]);
+    if (co_getret(echo) != -1) fail("Read on closed fd succeeded", __func__, __LINE__);
+    co_close(io_fds[0]);
+    // threads that park on the same fd one after the other, the second 
+    // one's epoll fd reuses the number of the first one's, now closed
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, io_fds) != 0) fail("Socketpair failed", __func__, __LINE__);
+    for (long delay_ms = 0; delay_ms <= 100; delay_ms += 100) {
+        pthread_t thread;
+        void *ret;
+        pthread_create(&thread, NULL, test_io_thread, (void *) delay_ms);
+        if (delay_ms > 0) {
+            struct timespec ts = {0, delay_ms * 1000000};
+            nanosleep(&ts, NULL);
+            write(io_fds[0], "x", 1);
+        }
+        pthread_join(thread, &ret);
+        if ((long) ret != 1) fail("Read on a reused fd not woken", __func__, __LINE__);
+    }
+    co_close(io_fds[0]), co_close(io_fds[1]);
+    return 0;
+}
+
+int test_sleep_inner() {
+    co_sleep(20 * 1000000LL);
+    return 7;
+}
+
+int test_sleep() {
+    struct timeval stop, start;
+    gettimeofday(&start, NULL);
+    cid_t cid[10];
+    // sleepers overlap rather than add up
+    for (int i = 0; i < 10; ++i) cid[i] = co_start(test_sleep_inner);
+    co_sleep(10 * 1000000LL);
+    if (co_wait_timeout(cid[0], 1000000LL) != TIMEDOUT) fail("Wait did not time out", __func__, __LINE__);
+    if (co_wait_timeout(cid[0], 1000000000LL) != 0) fail("Wait timed out", __func__, __LINE__);
+    for (int i = 0; i < 10; ++i) if (co_getret(cid[i]) != 7) fail("Sleep return value failed", __func__, __LINE__);
+    gettimeofday(&stop, NULL);
+    long long us = (stop.tv_sec - start.tv_sec) * 1000000LL + (stop.tv_usec - start.tv_usec);
+    if (us < 20000 || us > 200000) fail("Sleep took the wrong time", __func__, __LINE__);
+    return 0;
+}
+
+co_chan_t *chan;
+
+int test_chan_producer() {
+    for (int i = 1; i <= 1000; ++i) co_send(chan, &i);
+    co_chan_close(chan);
+    return 0;
+}
+
+int test_chan_consumer() {
+    int sum = 0, last = 0, value;
+    while (co_recv(chan, &value) == 0) {
+        if (value != last + 1) fail("Channel reordered", __func__, __LINE__);
+        sum += last = value;
+    }
+    return sum;
+}
+
+int test_chan() {
+    // buffered and unbuffered, consumer started first or last
+    for (int cap = 0; cap <= 4; cap += 4) {
+        chan = co_chan_create(cap, sizeof(int));
+        cid_t consumer = co_start(test_chan_consumer);
+        co_start(test_chan_producer);
+        if (co_getret(consumer) != 500500) fail("Channel sum failed", __func__, __LINE__);
+        co_chan_destroy(chan);
+        chan = co_chan_create(cap, sizeof(int));
+        co_start(test_chan_producer);
+        consumer = co_start(test_chan_consumer);
+        if (co_getret(consumer) != 500500) fail("Channel sum failed", __func__, __LINE__);
+        co_chan_destroy(chan);
+    }
+    return 0;
+}
+
+co_mutex_t sync_mutex;
+co_cond_t sync_cond;
+co_sem_t sync_sem;
+int sync_counter, sync_turn;
+
+int test_sync_mutex() {
+    for (int i = 0; i < 1000; ++i) {
+        co_mutex_lock(&sync_mutex);
+        // others run (and contend) while the lock is held
+        int value = sync_counter;
+        co_yield();
+        sync_counter = value + 1;
+        co_mutex_unlock(&sync_mutex);
+    }
+    return 0;
+}
+
+int test_sync_cond() {
+    // routines take turns in the order of sync_turn
+    int me = sync_counter++;
+    for (int i = 0; i < 100; ++i) {
+        co_mutex_lock(&sync_mutex);
+        while (sync_turn % 2 != me) co_cond_wait(&sync_cond, &sync_mutex);
+        sync_turn++;
+        co_cond_broadcast(&sync_cond);
+        co_mutex_unlock(&sync_mutex);
+    }
+    return 0;
+}
+
+int test_sync_sem() {
+    int got = 0;
+    for (int i = 0; i < 100; ++i) got += co_sem_wait(&sync_sem) == 0;
+    return got;
+}
+
+int test_sync() {
+    cid_t cid[4];
+    co_mutex_init(&sync_mutex);
+    sync_counter = 0;
+    for (int i = 0; i < 4; ++i) cid[i] = co_start(test_sync_mutex);
+    for (int i = 0; i < 4; ++i) co_wait(cid[i]);
+    if (sync_counter != 4000) fail("Mutex failed", __func__, __LINE__);
+
+    co_cond_init(&sync_cond);
+    sync_counter = sync_turn = 0;
+    for (int i = 0; i < 2; ++i) cid[i] = co_start(test_sync_cond);
+    for (int i = 0; i < 2; ++i) co_wait(cid[i]);
+    if (sync_turn != 200) fail("Condition variable failed", __func__, __LINE__);
+
+    co_sem_init(&sync_sem, 10);
+    cid[0] = co_start(test_sync_sem);
+    for (int i = 0; i < 90; ++i) co_sem_post(&sync_sem);
+    if (co_getret(cid[0]) != 100) fail("Semaphore failed", __func__, __LINE__);
+    return 0;
+}
+
+int test_gen_squares(void *arg) {
+    int n = *(int *) arg;
+    for (long i = 1; i <= n; ++i) co_yield_value(i * i);
+    return 0;
+}
+
+int test_gen() {
+    int n = 100;
+    long value, sum = 0;
+    co_gen_t *gen = co_gen_start(test_gen_squares, &n);
+    // nothing runs before the first co_gen_next
+    while (co_gen_next(gen, &value) == 1) sum += value;
+    if (sum != 338350) fail("Generator sum failed", __func__, __LINE__);
+    if (co_gen_next(gen, &value) != 0) fail("Generator resumed after return", __func__, __LINE__);
+    co_gen_destroy(gen);
+    // abandoned halfway
+    gen = co_gen_start(test_gen_squares, &n);
+    if (co_gen_next(gen, &value) != 1 || value != 1) fail("Generator first value failed", __func__, __LINE__);
+    co_gen_destroy(gen);
+    if (co_yield_value(1) != -1) fail("Yield value outside generator succeeded", __func__, __LINE__);
+    return 0;
+}
+
+co_chan_t *copystack_in, *copystack_out;
+int copystack_seed;
+
+// frames that must survive other routines running on the shared stack
+int test_copystack_frame(int depth, int seed) {
+    char frame[512];
+    memset(frame, seed + depth, sizeof(frame));
+    int ret = 0;
+    if (depth > 0) ret = test_copystack_frame(depth - 1, seed);
+    else {
+        // values on the shared stack, parked on in both directions
+        long value;
+        co_recv(copystack_in, &value);
+        co_yield();
+        co_sleep(1000000);
+        co_send(copystack_out, &value);
+    }
+    for (int i = 0; i < sizeof(frame); ++i) 
+        if (frame[i] != (char) (seed + depth)) ret = -1;
+    return ret;
+}
+
+int test_copystack_routine() {
+    return test_copystack_frame(8, copystack_seed++);
+}
+
+int test_copystack() {
+    cid_t cid[100];
+    if (co_set_shared_stack(256 * 1024) < 0) return 0;
+    copystack_in = co_chan_create(0, sizeof(long));
+    copystack_out = co_chan_create(0, sizeof(long));
+    for (int i = 0; i < 100; ++i) cid[i] = co_start(test_copystack_routine);
+    co_set_shared_stack(0);
+    for (long i = 0; i < 100; ++i) co_send(copystack_in, &i);
+    long value, sum = 0;
+    for (int i = 0; i < 100; ++i) co_recv(copystack_out, &value), sum += value;
+    if (sum != 4950) fail("Copy-stack channel sum failed", __func__, __LINE__);
+    for (int i = 0; i < 100; ++i) 
+        if (co_getret(cid[i]) != 0) fail("Copy-stack frame corrupted", __func__, __LINE__);
+    co_chan_destroy(copystack_in);
+    co_chan_destroy(copystack_out);
+    return 0;
+}
+
+_Atomic long spawn_sum;
+
+int test_spawn_routine(void *arg) {
+    spawn_sum += (long) arg;
+    return (int) (long) arg;
+}
+
+int test_spawn() {
+    void *args[100];
+    cid_t cids[100];
+    spawn_sum = 0;
+    cid_t cid = co_spawn(test_spawn_routine, (void *) 7L);
+    // nothing runs until the caller gives the CPU away
+    if (cid < 0 || co_status(cid) != RUNNING || spawn_sum != 0) fail("Spawned routine ran early", __func__, __LINE__);
+    if (co_getret(cid) != 7) fail("Spawn return value failed", __func__, __LINE__);
+    co_release(cid);
+    for (long i = 0; i < 100; ++i) args[i] = (void *) i;
+    if (co_spawn_n(test_spawn_routine, args, 100, cids) != 100) fail("Batch spawn failed", __func__, __LINE__);
+    for (int i = 0; i < 100; ++i) 
+        if (co_getret(cids[i]) != i) fail("Batch spawn return value failed", __func__, __LINE__);
+    for (int i = 0; i < 100; ++i) co_release(cids[i]);
+    // released at once
+    if (co_spawn_n(test_spawn_routine, args, 100, NULL) != 100) fail("Batch spawn failed", __func__, __LINE__);
+    co_waitall();
+    if (spawn_sum != 7 + 2 * 4950) fail("Spawn sum failed", __func__, __LINE__);
+    return 0;
+}
+
+int prio_low_progress, prio_high_done_at;
+co_sem_t prio_sem;
+int prio_order[3], prio_finished;
+
+int test_prio_low() {
+    co_setprio(co_getid(), CO_PRIO_LOW);
+    for (int i = 0; i < 100; ++i) prio_low_progress++, co_yield();
+    return 0;
+}
+
+int test_prio_high() {
+    co_setprio(co_getid(), CO_PRIO_HIGH);
+    for (int i = 0; i < 100; ++i) co_yield();
+    prio_high_done_at = prio_low_progress;
+    return 0;
+}
+
+int test_prio_deadline() {
+    int me = prio_finished++;
+    co_sem_wait(&prio_sem);
+    prio_order[prio_finished++ - 3] = me;
+    return 0;
+}
+
+int test_prio() {
+    cid_t cid[4];
+    prio_low_progress = 0;
+    for (int i = 0; i < 3; ++i) cid[i] = co_start(test_prio_low);
+    cid[3] = co_start(test_prio_high);
+    co_wait(cid[3]);
+    // aging lets the low ones in now and then, but no more
+    if (prio_high_done_at == 0 || prio_high_done_at > 100) fail("High priority routine was not preferred", __func__, __LINE__);
+    for (int i = 0; i < 3; ++i) co_wait(cid[i]);
+    if (prio_low_progress != 300) fail("Low priority routines starved", __func__, __LINE__);
+    if (co_setprio(cid[0], 5) != -1) fail("Bad priority accepted", __func__, __LINE__);
+
+    // woken all at once, run by deadline rather than in wake-up order
+    co_sem_init(&prio_sem, 0);
+    prio_finished = 0;
+    long long deadlines[3] = {3000000, 1000000, 2000000};
+    for (int i = 0; i < 3; ++i) cid[i] = co_start(test_prio_deadline);
+    for (int i = 0; i < 3; ++i) co_setdeadline(cid[i], deadlines[i]);
+    for (int i = 0; i < 3; ++i) co_sem_post(&prio_sem);
+    for (int i = 0; i < 3; ++i) co_wait(cid[i]);
+    if (prio_order[0] != 1 || prio_order[1] != 2 || prio_order[2] != 0) fail("Deadline order failed", __func__, __LINE__);
+    return 0;
+}
+
+volatile int preempt_done;
+volatile long preempt_progress;
+int preempt_section_ok;
+
+// spins without ever yielding
+int test_preempt_hog() {
+    while (!preempt_done) preempt_progress++;
+    return 0;
+}
+
+int test_preempt_section() {
+    co_preempt_disable();
+    long progress = preempt_progress;
+    // a few slices of CPU time, mostly outside of the vDSO
+    struct timeval start, now;
+    gettimeofday(&start, NULL);
+    do {
+        for (volatile int i = 0; i < 100000; ++i);
+        gettimeofday(&now, NULL);
+    } while ((now.tv_sec - start.tv_sec) * 1000000 + now.tv_usec - start.tv_usec < 20000);
+    preempt_section_ok = preempt_progress == progress;
+    co_preempt_enable();
+    preempt_done = 1;
+    return 0;
+}
+
+int test_preempt() {
+    if (co_set_preempt(1000000) < 0) {
+        printf("Main: preemption unsupported, skipped.\n");
+        return 0;
+    }
+    // the hog only lets main go on once preempted, and only stops once 
+    // the section has run, which itself can't be preempted
+    preempt_done = 0;
+    cid_t hog = co_start(test_preempt_hog);
+    cid_t section = co_start(test_preempt_section);
+    co_wait(hog), co_wait(section);
+    co_release(hog), co_release(section);
+    co_set_preempt(0);
+    if (preempt_progress == 0) fail("Hog never ran", __func__, __LINE__);
+    if (!preempt_section_ok) fail("Critical section was preempted", __func__, __LINE__);
+    return 0;
+}
+
+int group_sum, group_loops;
+
+int test_group_member(void *arg) {
+    co_yield();
+    group_sum += (int) (long) arg;
+    return 0;
+}
+
+int test_group_looper(void *arg) {
+    while (!co_cancelled()) group_loops++, co_yield();
+    return 0;
+}
+
+int test_group() {
+    co_group_t *group = co_group_create();
+    group_sum = 0;
+    for (long i = 1; i <= 100; ++i) co_group_spawn(group, test_group_member, (void *) i);
+    if (co_group_join(group) != 0) fail("Members were cancelled", __func__, __LINE__);
+    if (group_sum != 5050) fail("Join returned before every member finished", __func__, __LINE__);
+    co_group_destroy(group);
+
+    // the looper starts, the other members are cancelled before they do
+    group = co_group_create();
+    group_sum = group_loops = 0;
+    co_group_spawn(group, test_group_looper, NULL);
+    co_yield();
+    for (long i = 1; i <= 100; ++i) co_group_spawn(group, test_group_member, (void *) i);
+    co_group_cancel(group);
+    if (co_group_join(group) != 100) fail("Cancelled members not skipped", __func__, __LINE__);
+    if (group_sum != 0) fail("Cancelled member ran", __func__, __LINE__);
+    if (group_loops == 0) fail("Running member didn't run", __func__, __LINE__);
+    co_group_destroy(group);
+    return 0;
+}
+
+// a few ms of CPU time, yielding now and then
+int test_prof_busy() {
+    struct timeval start, now;
+    gettimeofday(&start, NULL);
+    do {
+        for (volatile int i = 0; i < 100000; ++i);
+        co_yield();
+        gettimeofday(&now, NULL);
+    } while ((now.tv_sec - start.tv_sec) * 1000000 + now.tv_usec - start.tv_usec < 50000);
+    return 0;
+}
+
+cid_t prof_busy;
+
+int test_prof_waiter() {
+    co_wait(prof_busy);
+    return 0;
+}
+
+int test_prof() {
+    if (co_prof_start(1000000) < 0) fail("Profiler failed to start", __func__, __LINE__);
+    prof_busy = co_start(test_prof_busy);
+    cid_t waiter = co_start(test_prof_waiter);
+    co_wait(waiter);
+    co_prof_stop();
+    co_stats_t busy_stats, waiter_stats;
+    if (co_stats(prof_busy, &busy_stats) < 0 || co_stats(waiter, &waiter_stats) < 0)
+        fail("Stats unavailable", __func__, __LINE__);
+    if (busy_stats.switches < 2 || busy_stats.run_ns < 20000000)
+        fail("Busy routine not accounted", __func__, __LINE__);
+    if (waiter_stats.wait_ns < 20000000 || waiter_stats.run_ns > busy_stats.run_ns)
+        fail("Waiting routine not accounted", __func__, __LINE__);
+
+    // most samples fall in the busy routine
+    FILE *out = tmpfile();
+    if (co_prof_dump(fileno(out), 1) <= 0) fail("No samples", __func__, __LINE__);
+    rewind(out);
+    char line[4096], prefix[32];
+    int found = 0;
+    sprintf(prefix, "cid %d;", (int) prof_busy);
+    while (fgets(line, sizeof(line), out) != NULL)
+        found |= strncmp(line, prefix, strlen(prefix)) == 0;
+    fclose(out);
+    if (!found) fail("Busy routine never sampled", __func__, __LINE__);
+    co_release(prof_busy), co_release(waiter);
+    return 0;
+}
+
+int test_stack_shallow(void *arg) {
+    return 0;
+}
+
+int test_stack_deep(void *arg) {
+    volatile char buf[12 * 1024];
+    for (int i = 0; i < (int) sizeof(buf); i += 512) buf[i] = 1;
+    return buf[0];
+}
+
+// as deep, but writes nothing but zeros
+int test_stack_zeros(void *arg) {
+    volatile char buf[12 * 1024];
+    for (int i = 0; i < (int) sizeof(buf); i += 512) buf[i] = 0;
+    return buf[0];
+}
+
+int test_stack() {
+    co_set_stack_mode(CO_STACK_ADAPT);
+    for (int round = 0; round < 32; ++round) {
+        co_spawn_n(test_stack_shallow, NULL, 4, NULL);
+        co_spawn_n(test_stack_deep, NULL, 4, NULL);
+        co_spawn_n(test_stack_zeros, NULL, 4, NULL);
+        co_waitall();
+    }
+    co_set_stack_mode(CO_STACK_FIXED);
+    co_stack_stats_t stats[256];
+    int n = co_stack_stats(stats, 256), found = 0;
+    for (int i = 0; i < n && i < 256; ++i) {
+        if (stats[i].entry == (void *) test_stack_shallow) {
+            found |= 1;
+            if (stats[i].count < 16 || stats[i].max >= 8192) fail("Shallow routine mismeasured", __func__, __LINE__);
+            if (stats[i].size == 0 || stats[i].size >= DEFAULT_STACK_SIZE) fail("Shallow routine not resized", __func__, __LINE__);
+        } else if (stats[i].entry == (void *) test_stack_deep) {
+            found |= 2;
+            if (stats[i].count < 16 || stats[i].max < 12 * 1024) fail("Deep routine mismeasured", __func__, __LINE__);
+            if (stats[i].size < stats[i].max) fail("Deep routine too small", __func__, __LINE__);
+        } else if (stats[i].entry == (void *) test_stack_zeros) {
+            found |= 4;
+            if (stats[i].count < 16 || stats[i].max < 12 * 1024) fail("Zero-filled routine mismeasured", __func__, __LINE__);
+            if (stats[i].size < stats[i].max) fail("Zero-filled routine too small", __func__, __LINE__);
+        }
+    }
+    if (found != 7) fail("Routines not tracked", __func__, __LINE__);
+    return 0;
+}
+
+co_chan_t *idle_chan;
+int idle_fds[2];
+
+void *test_idle_sender(void *ptr) {
+    struct timespec ts = {0, 100000000};
+    nanosleep(&ts, NULL);
+    long value = 42;
+    co_send(idle_chan, &value);
+    return NULL;
+}
+
+int test_idle_reader() {
+    char c;
+    return co_read(idle_fds[0], &c, 1) == 1? c: -1;
+}
+
+// the thread blocks while nothing can run, in epoll_wait if it polls fds, 
+// and a wake-up from another thread gets it going at once
+int test_idle() {
+    for (int polling = 0; polling < 2; ++polling) {
+        idle_chan = co_chan_create(0, sizeof(long));
+        cid_t reader = -1;
+        if (polling) {
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, idle_fds) < 0) fail("Socketpair failed", __func__, __LINE__);
+            reader = co_start(test_idle_reader);
+        }
+        pthread_t sender;
+        struct timespec start, end;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+        pthread_create(&sender, NULL, test_idle_sender, NULL);
+        long value = 0;
+        co_recv(idle_chan, &value);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+        pthread_join(sender, NULL);
+        if (value != 42) fail("Cross-thread wake-up lost", __func__, __LINE__);
+        long long cpu = (end.tv_sec - start.tv_sec) * 1000000000LL + end.tv_nsec - start.tv_nsec;
+        if (cpu > 20000000) fail("Idle thread kept running", __func__, __LINE__);
+        if (polling) {
+            co_write(idle_fds[1], "x", 1);
+            if (co_getret(reader) != 'x') fail("Reader not woken", __func__, __LINE__);
+            co_release(reader);
+            co_close(idle_fds[0]), co_close(idle_fds[1]);
+        }
+        co_chan_destroy(idle_chan);
+    }
+    return 0;
+}
+
+int blocking_ticks, blocking_done;
+
+long test_blocking_call(void *arg) {
+    struct timespec ts = {0, 50000000};
+    nanosleep(&ts, NULL);
+    errno = EAGAIN;
+    return (long) arg;
+}
+
+int test_blocking_caller(void *arg) {
+    long ret = co_blocking(test_blocking_call, arg);
+    if (ret != (long) arg || errno != EAGAIN) fail("Blocking call result lost", __func__, __LINE__);
+    blocking_done++;
+    return 0;
+}
+
+int test_blocking_ticker() {
+    while (blocking_done < 8) co_sleep(1000000), blocking_ticks++;
+    return 0;
+}
+
+// the thread keeps running routines while blocking calls run elsewhere,
+// and calls beyond the helper limit queue up
+int test_blocking() {
+    co_set_blocking_threads(4);
+    co_group_t *group = co_group_create();
+    for (long i = 0; i < 8; ++i) co_group_spawn(group, test_blocking_caller, (void *) i);
+    cid_t ticker = co_start(test_blocking_ticker);
+    co_blocking_stats_t stats;
+    co_sleep(10000000);
+    co_blocking_stats(&stats);
+    if (stats.threads != 4 || stats.busy != 4 || stats.queued != 4) fail("Blocking calls not queued", __func__, __LINE__);
+    co_group_join(group);
+    co_group_destroy(group);
+    co_wait(ticker), co_release(ticker);
+    // two rounds of 50 ms, ticking every ms meanwhile
+    if (blocking_ticks < 40) fail("Thread blocked by blocking calls", __func__, __LINE__);
+    co_blocking_stats(&stats);
+    if (stats.busy != 0 || stats.queued != 0) fail("Blocking calls left over", __func__, __LINE__);
+    return 0;
+}
+
+cid_t state_cid;
+
+int test_state_routine() {
+    co_yield();
+    return -5;
+}
+
+void *test_state_reader(void *ptr) {
+    // parks till the routine finishes on the main thread
+    if (co_getret(state_cid) != -5) fail("Return value lost across threads", __func__, __LINE__);
+    if (co_getret(state_cid) != -5) fail("Return value lost across threads", __func__, __LINE__);
+    return NULL;
+}
+
+// status and return value are read from another thread, negative ones too
+int test_state() {
+    state_cid = co_start(test_state_routine);
+    pthread_t reader;
+    pthread_create(&reader, NULL, test_state_reader, NULL);
+    co_wait(state_cid);
+    pthread_join(reader, NULL);
+    if (co_status(state_cid) != FINISHED || co_getret(state_cid) != -5) fail("Status or return value wrong", __func__, __LINE__);
+    co_release(state_cid);
+    return 0;
+}
+
+co_key_t local_keys[8];
+int local_freed;
+
+void test_local_free(void *value) {
+    local_freed++;
+}
+
+int test_local_routine(void *arg) {
+    long id = (long) arg;
+    for (int k = 0; k < 8; ++k) {
+        if (co_getspecific(local_keys[k]) != NULL) fail("Local value not NULL at start", __func__, __LINE__);
+        co_setspecific(local_keys[k], (void *) (id * 8 + k + 1));
+    }
+    co_yield();
+    for (int k = 0; k < 8; ++k)
+        if (co_getspecific(local_keys[k]) != (void *) (id * 8 + k + 1)) fail("Local value mixed up", __func__, __LINE__);
+    return 0;
+}
+
+// every routine sees its own values, in place and spilled alike, 
+// and they are destructed when it returns
+int test_local() {
+    for (int k = 0; k < 8; ++k)
+        if (co_key_create(&local_keys[k], test_local_free) < 0) fail("Key creation failed", __func__, __LINE__);
+    co_setspecific(local_keys[0], (void *) -1L);
+    co_setspecific(local_keys[7], (void *) -7L);
+    local_freed = 0;
+    co_group_t *group = co_group_create();
+    for (long i = 0; i < 10; ++i) co_group_spawn(group, test_local_routine, (void *) i);
+    co_group_join(group);
+    co_group_destroy(group);
+    if (local_freed != 80) fail("Local values not destructed", __func__, __LINE__);
+    if (co_getspecific(local_keys[0]) != (void *) -1L || co_getspecific(local_keys[7]) != (void *) -7L) fail("Main local value lost", __func__, __LINE__);
+    co_setspecific(local_keys[0], NULL), co_setspecific(local_keys[7], NULL);
+    if (co_setspecific(CO_KEYS_MAX, NULL) != -1) fail("Invalid key accepted", __func__, __LINE__);
+    return 0;
+}
+
+int test_wait_any_sleeper(void *arg) {
+    co_sleep((long) arg * 1000000);
+    return (int) (long) arg;
+}
+
+// the fastest of a fan-out is joined first, then the rest at once
+int test_wait_any() {
+    long ms[5] = {40, 30, 20, 5, 50};
+    cid_t cids[5];
+    int which = -1;
+    for (int i = 0; i < 5; ++i) cids[i] = co_spawn(test_wait_any_sleeper, (void *) ms[i]);
+    if (co_wait_any(cids, 5, &which) != 0 || which != 3) fail("Wrong routine joined first", __func__, __LINE__);
+    if (co_status(cids[3]) != FINISHED || co_status(cids[2]) != RUNNING) fail("Status after wait_any wrong", __func__, __LINE__);
+    // a finished one is found without parking
+    if (co_wait_any(cids, 5, &which) != 0 || which != 3) fail("Finished routine not found", __func__, __LINE__);
+    if (co_wait_all_of(cids, 5) != 0) fail("Wait all failed", __func__, __LINE__);
+    for (int i = 0; i < 5; ++i)
+        if (co_status(cids[i]) != FINISHED || co_getret(cids[i]) != ms[i]) fail("Routine not joined", __func__, __LINE__);
+    if (co_wait_all_of(cids, 5) != 0) fail("Wait all on finished failed", __func__, __LINE__);
+    for (int i = 0; i < 5; ++i) co_release(cids[i]);
+    if (co_wait_any(cids, 5, &which) != -1) fail("Released cids accepted", __func__, __LINE__);
+    return 0;
+}
+
 //test multithread
 _Atomic int total_coroutine_count = 0;
 
@@ -101,6 +779,26 @@ int test_multithread() {
     return 0;
 }
 
+int test_pool_root() {
+    const int CNT = 20;
+    cid_t coroutine[CNT];
+    for (int i = 0; i < CNT; ++i) {
+        coroutine[i] = co_start(test_multithread_coroutine);
+    }
+    for (int i = 0; i < CNT; ++i) {
+        assert(co_getret(coroutine[i]) == 1);
+        assert(co_status(coroutine[i]) == FINISHED);
+    }
+    return 300;
+}
+
+int test_pool() {
+    total_coroutine_count = 0;
+    if (co_pool_run(4, test_pool_root) != 300) fail("Pool return value failed", __func__, __LINE__);
+    assert(total_coroutine_count == 200);
+    return 0;
+}
+
 int test_multithread_timer() {
     // close output when timing
     struct timeval stop, start;
@@ -144,8 +842,46 @@ int main(){
     if(coroutine[0] != getid_val) fail("Get ID differs from internal getid", __func__, __LINE__);
     if(coroutine[0] != co_getret(getid_val)) fail("Get ID differs from internal return value", __func__, __LINE__);
     printf("Main: test getid finished.\n");
+    test_release();
+    printf("Main: test release finished.\n");
+    test_io();
+    printf("Main: test io finished.\n");
+    test_sleep();
+    printf("Main: test sleep finished.\n");
+    test_chan();
+    printf("Main: test chan finished.\n");
+    test_sync();
+    printf("Main: test sync finished.\n");
+    test_gen();
+    printf("Main: test gen finished.\n");
+    test_copystack();
+    printf("Main: test copystack finished.\n");
+    test_spawn();
+    printf("Main: test spawn finished.\n");
+    test_prio();
+    printf("Main: test prio finished.\n");
+    test_preempt();
+    printf("Main: test preempt finished.\n");
+    test_group();
+    printf("Main: test group finished.\n");
+    test_prof();
+    printf("Main: test prof finished.\n");
+    test_stack();
+    printf("Main: test stack finished.\n");
+    test_idle();
+    printf("Main: test idle finished.\n");
+    test_blocking();
+    printf("Main: test blocking finished.\n");
+    test_state();
+    printf("Main: test state finished.\n");
+    test_local();
+    printf("Main: test local finished.\n");
+    test_wait_any();
+    printf("Main: test wait_any finished.\n");
     test_multithread();
     test_multithread_timer();
+    test_pool();
+    printf("Main: test pool finished.\n");
     printf("Finish running.\n");
     return 0;
 }